@@ -33,33 +33,193 @@
 */
 
 #include <sql/table.h>
+#include <algorithm>
+#include <atomic>
+
+#include "my_byteorder.h"
+#include "my_sqlcommand.h"
+#include "my_sys.h"
 #include "my_dbug.h"
+#include "my_systime.h"
 #include "mysql/plugin.h"
+#include "mysqld_error.h"
+#include "sql/derror.h"
+#include "sql/key.h"
+#include "sql/query_options.h"
 #include "sql/sql_class.h"
+#include "sql/sql_error.h"
+#include "sql/sql_lex.h"
 #include "sql/sql_plugin.h"
 #include "typelib.h"
 #include "sql/field.h"
+#include "sql/item.h"
+#include "sql/item_cmpfunc.h"
+#include "sql/item_sum.h"
 
 #include "ha_redis.h"
 #include "hiredis.h" /* for redis */
+#include "redis_io.h"
+#include "redis_replication.h"
+#include "redis_scripts.h"
+#include "redis_write_behind.h"
 
 static handler *redis_create_handler(handlerton *hton, TABLE_SHARE *table, bool partitioned, MEM_ROOT *mem_root);
 
 handlerton *redis_hton;
+handlerton *redis_secondary_hton;
 
 /* Interface to mysqld, to check system tables supported by SE */
 static bool redis_is_supported_system_table(const char *db,
                                               const char *table_name,
                                               bool is_sql_layer_system_table);
 
-Redis_share::Redis_share() { thr_lock_init(&lock); }
+Redis_share::Redis_share()
+    : layout(REDIS_LAYOUT_LIST), stream_maxlen(0), stream_retention(0), ttl(0),
+      expire_field(-1), write_behind(false), behind_mark(0) {
+    thr_lock_init(&lock);
+}
+
+static char *srv_host;
+static uint srv_port;
+static char *srv_replicas;
+
+static MYSQL_SYSVAR_STR(host, srv_host, PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+                        "Host of the primary Redis server.",
+                        NULL, NULL, "127.0.0.1");
+
+static MYSQL_SYSVAR_UINT(port, srv_port, PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+                         "Port of the primary Redis server.",
+                         NULL, NULL, 6379, 1, 65535, 0);
+
+static MYSQL_SYSVAR_STR(replicas, srv_replicas, PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+                        "Comma separated host:port of the replicas read-only "
+                        "statements may read from, as the replicas announce "
+                        "themselves in INFO replication on the primary.",
+                        NULL, NULL, "");
+
+static MYSQL_SYSVAR_ULONG(command_timeout, redis_command_timeout, PLUGIN_VAR_RQCMDARG,
+                          "Milliseconds a Redis command may take before the "
+                          "statement fails. 0 means no deadline.",
+                          NULL, NULL, 0, 0, 3600 * 1000, 0);
+
+static uint srv_hedge_percentile;
+
+static MYSQL_SYSVAR_UINT(hedge_percentile, srv_hedge_percentile, PLUGIN_VAR_RQCMDARG,
+                         "A point read served by a replica and not answered "
+                         "within this percentile of point read latency is sent "
+                         "to the primary too. 0 disables hedged reads.",
+                         NULL, NULL, 95, 0, 100, 0);
+
+static MYSQL_THDVAR_BOOL(read_from_replicas, PLUGIN_VAR_OPCMDARG,
+                         "Let statements which only read a table read it "
+                         "from a replica.",
+                         NULL, NULL, false);
+
+static MYSQL_THDVAR_ULONG(replica_max_lag, PLUGIN_VAR_RQCMDARG,
+                          "Bytes of replication stream a replica may be behind "
+                          "the primary and still be read from.",
+                          NULL, NULL, 1024 * 1024, 0, ULONG_MAX, 0);
+
+static ulong srv_blob_inline_limit;
+
+static MYSQL_SYSVAR_ULONG(blob_inline_limit, srv_blob_inline_limit, PLUGIN_VAR_RQCMDARG,
+                          "BLOB, TEXT, JSON and GEOMETRY values longer than this "
+                          "many bytes are stored apart from their row and only "
+                          "read by statements which use the column. 0 keeps "
+                          "every value in its row.",
+                          NULL, NULL, 8192, 0, ULONG_MAX, 0);
+
+static MYSQL_THDVAR_ULONG(scan_batch_size, PLUGIN_VAR_RQCMDARG,
+                          "Number of rows fetched per round trip by a table scan.",
+                          NULL, NULL, 64, 1, 65536, 0);
+
+static MYSQL_THDVAR_BOOL(transactional, PLUGIN_VAR_OPCMDARG,
+                         "Buffer the writes of a statement or transaction and "
+                         "apply them as one MULTI/EXEC at commit.",
+                         NULL, NULL, false);
+
+static MYSQL_THDVAR_UINT(commit_wait_replicas, PLUGIN_VAR_RQCMDARG,
+                         "Number of Redis replicas a transactional commit "
+                         "waits for with WAIT. 0 means no wait.",
+                         NULL, NULL, 0, 0, 64, 0);
+
+static MYSQL_THDVAR_ULONG(commit_wait_timeout, PLUGIN_VAR_RQCMDARG,
+                          "Timeout in milliseconds of the WAIT issued at commit.",
+                          NULL, NULL, 1000, 0, 3600 * 1000, 0);
+
+static MYSQL_THDVAR_ULONG(secondary_max_age, PLUGIN_VAR_RQCMDARG,
+                          "Seconds after ALTER TABLE ... SECONDARY_LOAD during "
+                          "which queries may read the table from its Redis "
+                          "mirror, as long as the primary table isn't written "
+                          "to. Older mirrors leave the query to the primary "
+                          "engine. 0 means no limit.",
+                          NULL, NULL, 3600, 0, ULONG_MAX, 0);
+
+static MYSQL_THDVAR_BOOL(write_behind, PLUGIN_VAR_OPCMDARG,
+                         "Queue the inserts of the session and write them to "
+                         "Redis in the background. The statement doesn't wait "
+                         "for them, and an insert Redis refuses is only counted "
+                         "in Redis_write_behind_failed.",
+                         NULL, NULL, false);
+
+static MYSQL_SYSVAR_ULONG(write_behind_interval, redis_write_behind_interval,
+                          PLUGIN_VAR_RQCMDARG,
+                          "Milliseconds queued inserts may wait before they are "
+                          "written, unless enough are queued to fill a batch.",
+                          NULL, NULL, 100, 1, 60 * 1000, 0);
+
+static ulong srv_write_behind_queue_size;
+
+static MYSQL_SYSVAR_ULONG(write_behind_queue_size, srv_write_behind_queue_size,
+                          PLUGIN_VAR_RQCMDARG | PLUGIN_VAR_READONLY,
+                          "Inserts the write-behind queue holds, rounded up to a "
+                          "power of two. A session finding it full waits.",
+                          NULL, NULL, 65536, 1024, 16 * 1024 * 1024, 0);
+
+enum redis_concurrency_mode { REDIS_CONCURRENCY_TABLE, REDIS_CONCURRENCY_OPTIMISTIC };
+static ulong srv_concurrency = REDIS_CONCURRENCY_TABLE;
+
+const char *concurrency_names[] = {"TABLE", "OPTIMISTIC", NullS};
+
+TYPELIB concurrency_typelib = {array_elements(concurrency_names) - 1,
+                               "concurrency_typelib", concurrency_names, NULL};
+
+static MYSQL_SYSVAR_ENUM(concurrency, srv_concurrency, PLUGIN_VAR_RQCMDARG,
+                         "TABLE: writers take table locks. OPTIMISTIC: writers "
+                         "run concurrently and a row changed since it was read "
+                         "fails the statement (or the transaction) with "
+                         "ER_CHECKREAD, which can be retried.",
+                         NULL, NULL, REDIS_CONCURRENCY_TABLE, &concurrency_typelib);
+
+/* Counters shown as status variables */
+struct redis_status_t {
+    std::atomic<ulong> conflicts;  ///< writes which lost an optimistic race
+    std::atomic<ulong> replica_reads;  ///< statements which read from a replica
+};
+
+static redis_status_t redis_status;
+
+static int redis_commit(handlerton *hton, THD *thd, bool commit_trx);
+static int redis_rollback(handlerton *hton, THD *thd, bool rollback_trx);
+static int redis_close_connection(handlerton *hton, THD *thd);
 
 static int redis_init_func(void *p) {
+    redis_scripts_init();
+    if (!redis_replicas_init(srv_replicas)) {
+        return 1;
+    }
+    if (!redis_write_behind_start(srv_host, (int)srv_port, srv_write_behind_queue_size)) {
+        return 1;
+    }
+
     redis_hton = (handlerton *)p;
     redis_hton->state = SHOW_OPTION_YES;
     redis_hton->create = redis_create_handler;
+    redis_hton->commit = redis_commit;
+    redis_hton->rollback = redis_rollback;
+    redis_hton->close_connection = redis_close_connection;
     redis_hton->flags = (
-            HTON_ALTER_NOT_SUPPORTED| HTON_CAN_RECREATE | HTON_NO_PARTITION
+            HTON_CAN_RECREATE | HTON_NO_PARTITION
     );
     redis_hton->is_supported_system_table = redis_is_supported_system_table;
 
@@ -68,531 +228,3486 @@ static int redis_init_func(void *p) {
 
 /**
   @brief
-  Redis of simple lock controls. The "share" it creates is a
-  structure we will pass to each redis handler. Do you have to have
-  one of these? Well, you have pieces that are used for locking, and
-  they are needed to function.
+  Write the inserts still queued before the plugin goes away.
 */
-Redis_share *ha_redis::get_share() {
-    Redis_share *tmp_share;
-    DBUG_ENTER("ha_redis::get_share()");
-
-    lock_shared_ha_data();
-    if (!(tmp_share = static_cast<Redis_share *>(get_ha_share_ptr()))) {
-        tmp_share = new Redis_share;
-        if (!tmp_share) goto err;
+static int redis_deinit_func(void *) {
+    redis_write_behind_stop();
+    return 0;
+}
 
-        set_ha_share_ptr(static_cast<Handler_share *>(tmp_share));
+/**
+  @brief
+  Before a query is optimized for the secondary engine: leave it to the
+  primary engine if the mirror of one of its tables is stale (see
+  ha_redis::mirror_current()).
+*/
+static bool redis_prepare_secondary_engine(THD *thd, LEX *lex) {
+    ulong max_age = THDVAR(thd, secondary_max_age);
+    for (TABLE_LIST *tl = lex->query_tables; tl != NULL; tl = tl->next_global) {
+        if (tl->table && tl->table->file->ht == redis_secondary_hton &&
+            !static_cast<ha_redis *>(tl->table->file)->mirror_current(max_age)) {
+            my_error(ER_PREPARE_FOR_PRIMARY_ENGINE, MYF(0));
+            return true;
+        }
     }
-    err:
-    unlock_shared_ha_data();
-    DBUG_RETURN(tmp_share);
+    return false;
 }
 
-static handler *redis_create_handler(handlerton *hton, TABLE_SHARE *table, bool, MEM_ROOT *mem_root) {
-    return new (mem_root) ha_redis(hton, table);
-}
+/**
+  @brief
+  The REDIS_SECONDARY engine: SECONDARY_ENGINE = REDIS_SECONDARY mirrors a
+  table of another engine in Redis (see ha_redis::load_table()). A
+  secondary engine can't be the engine of a table, hence a handlerton of
+  its own, sharing the handler and the settings of REDIS.
+*/
+static int redis_secondary_init_func(void *p) {
+    redis_scripts_init();
 
-ha_redis::ha_redis(handlerton *hton, TABLE_SHARE *table_arg)
-    : handler(hton, table_arg),
-    current_position(0) {
-}
+    redis_secondary_hton = (handlerton *)p;
+    redis_secondary_hton->state = SHOW_OPTION_YES;
+    redis_secondary_hton->create = redis_create_handler;
+    redis_secondary_hton->flags = HTON_IS_SECONDARY_ENGINE;
+    redis_secondary_hton->prepare_secondary_engine = redis_prepare_secondary_engine;
 
-/*
-  List of all system tables specific to the SE.
-  Array element would look like below,
-     { "<database_name>", "<system table name>" },
-  The last element MUST be,
-     { (const char*)NULL, (const char*)NULL }
+    return 0;
+}
 
-  This array is optional, so every SE need not implement it.
+/**
+  @brief
+  Name of the hash holding the unique index of a table.
 */
-static st_handler_tablename ha_redis_system_tables[] = {
-        {(const char *)NULL, (const char *)NULL}
-};
+static std::string redis_index_name(const std::string &table_name) {
+    return table_name + ":pk";
+}
 
 /**
-  @brief Check if the given db.tablename is a system table for this SE.
-
-  @param db                         Database name to check.
-  @param table_name                 table name to check.
-  @param is_sql_layer_system_table  if the supplied db.table_name is a SQL
-                                    layer system table.
+  @brief
+  Name of the list holding the positions of the tombstones of a list table,
+  which inserts take (see FREE_SLOTS in redis_scripts.cc).
+*/
+static std::string redis_free_name(const std::string &table_name) {
+    return table_name + ":free";
+}
 
-  @return
-    @retval true   Given db.table_name is supported system table.
-    @retval false  Given db.table_name is not a supported system table.
+/**
+  @brief
+  Name of the key holding the ID of the last entry deleted from a stream
+  table (see STREAM_LAST in redis_scripts.cc).
 */
-static bool redis_is_supported_system_table(const char *db,
-                                              const char *table_name,
-                                              bool is_sql_layer_system_table) {
-    st_handler_tablename *systab;
+static std::string redis_stream_last_name(const std::string &table_name) {
+    return table_name + ":last";
+}
 
-    if (is_sql_layer_system_table) return false; // Does this SE support "ALL" SQL layer system tables ?
+/**
+  @brief
+  Name of the hash holding the out-of-line BLOB values of a table.
+*/
+static std::string redis_blob_name(const std::string &table_name) {
+    return table_name + ":blobs";
+}
 
-    // Check if this is SE layer system tables
-    systab = ha_redis_system_tables;
-    while (systab && systab->db) {
-        if (systab->db == db && strcmp(systab->tablename, table_name) == 0)
-            return true;
-        systab++;
-    }
+/**
+  @brief
+  Name of the string holding the live checksum of a table.
+*/
+static std::string redis_checksum_name(const std::string &table_name) {
+    return table_name + ":checksum";
+}
 
-    return false;
+/**
+  @brief
+  Name of the list mirroring a table of another engine.
+*/
+static std::string redis_mirror_name(const std::string &table_name) {
+    return table_name + ":mirror";
 }
 
 /**
   @brief
-  Used for opening tables. The name will be the name of the list key in redis.
+  Name of the key holding the time (seconds since the epoch) a mirror was
+  loaded at.
+*/
+static std::string redis_mirror_loaded_name(const std::string &mirror_name) {
+    return mirror_name + ":loaded";
+}
 
-  @see
-  handler::ha_open() in handler.cc
+/**
+  @brief
+  Name of the counter the AUTO_INCREMENT values of a table are taken from.
 */
-int ha_redis::open(const char *tname, int, uint, const dd::Table *) {
-    DBUG_ENTER("ha_redis::open");
+static std::string redis_auto_inc_name(const std::string &table_name) {
+    return table_name + ":autoinc";
+}
 
-    if (!(share = get_share())) return 1;
-    thr_lock_data_init(&share->lock, &lock, NULL);
+/**
+  @brief
+  Name of the hash holding rows id * REDIS_BUCKET_ROWS .. of a table in the
+  bucket layout (see REDIS_SCRIPT_BUCKET_INSERT).
+*/
+static std::string redis_bucket_name(const std::string &table_name, ulonglong bucket) {
+    return table_name + ":b:" + std::to_string(bucket);
+}
 
-    c = redisConnect("127.0.0.1", 6379);
-    if (c != NULL && c->err) {
-        DBUG_RETURN(-1);
+/**
+  @brief
+  Value of an option given in the table COMMENT as name=value, options
+  separated by spaces or commas. Empty if the option isn't there.
+*/
+static std::string redis_table_option(const TABLE_SHARE *s, const char *name) {
+    std::string comment(s->comment.str ? s->comment.str : "", s->comment.length);
+    std::string prefix = std::string(name) + "=";
+    size_t pos = 0;
+
+    while ((pos = comment.find(prefix, pos)) != std::string::npos) {
+        if (pos == 0 || comment[pos - 1] == ' ' || comment[pos - 1] == ',') {
+            size_t start = pos + prefix.length();
+            size_t end = comment.find_first_of(" ,", start);
+            return comment.substr(start, end == std::string::npos ? end : end - start);
+        }
+        pos += prefix.length();
     }
+    return "";
+}
 
-    share->table_name = get_table_name(tname);
+/**
+  @brief
+  Layout a table is created with (COMMENT 'redis_layout=...').
+  @return false if the option names no layout.
+*/
+static bool redis_table_layout(const TABLE_SHARE *s, redis_layout *layout) {
+    std::string name = redis_table_option(s, "redis_layout");
+    if (name.empty() || name == "list") {
+        *layout = REDIS_LAYOUT_LIST;
+    } else if (name == "buckets") {
+        *layout = REDIS_LAYOUT_BUCKETS;
+    } else if (name == "stream") {
+        *layout = REDIS_LAYOUT_STREAM;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-    DBUG_RETURN(0);
+/**
+  @brief
+  Column named by redis_expire_column in the table COMMENT, -1 if none.
+  @return false if the option names no TIMESTAMP or DATETIME column.
+*/
+static bool redis_expire_field(const TABLE_SHARE *s, int *field_index) {
+    std::string name = redis_table_option(s, "redis_expire_column");
+    *field_index = -1;
+    if (name.empty()) {
+        return true;
+    }
+    for (uint i = 0; i < s->fields; i++) {
+        const Field *field = s->field[i];
+        if (my_strcasecmp(system_charset_info, field->field_name, name.c_str()) == 0) {
+            if (field->type() != MYSQL_TYPE_TIMESTAMP && field->type() != MYSQL_TYPE_DATETIME) {
+                return false;
+            }
+            *field_index = (int)i;
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
   @brief
-  Closes a table.
+  Whether the index of a stream table can be the order of the stream: a
+  non-unique index over one NOT NULL column whose sort key fits into the
+  first part of an entry ID (integers, DATE, DATETIME, TIMESTAMP, ...).
+  A retention in seconds needs a TIMESTAMP column (see
+  ha_redis::stream_trim_args()).
 */
-int ha_redis::close(void) {
-    // DBUG_TRACE;
-    return 0;
+static bool redis_stream_index_supported(const TABLE *form) {
+    if (form->s->keys == 0) {
+        return true;
+    }
+    const KEY *key_info = form->key_info;
+    if ((key_info->flags & HA_NOSAME) || key_info->user_defined_key_parts != 1) {
+        return false;
+    }
+    const Field *field = key_info->key_part[0].field;
+    if (field->is_nullable() || field->sort_length() > sizeof(ulonglong)) {
+        return false;
+    }
+    return redis_table_option(form->s, "redis_stream_retention").empty() ||
+           field->type() == MYSQL_TYPE_TIMESTAMP;
 }
 
 /**
   @brief
-  write_row() inserts a row. No extra() hint is given currently if a bulk load
-  is happening. buf() is a byte array of data. You can use the field
-  information to extract the data from the native byte array type.
+  Entry ID of a stream from its two parts.
+*/
+static std::string redis_stream_id(ulonglong key, ulonglong seq) {
+    return std::to_string(key) + "-" + std::to_string(seq);
+}
 
-  @details
-  Redis of this would be:
-  @code
-  for (Field **field=table->field ; *field ; field++)
-  {
-    ...
-  }
-  @endcode
+static void redis_stream_parse_id(const std::string &id, ulonglong *key, ulonglong *seq) {
+    char *end;
+    *key = strtoull(id.c_str(), &end, 10);
+    *seq = (*end == '-') ? strtoull(end + 1, NULL, 10) : 0;
+}
 
-  See ha_tina.cc for an example of extracting all of the data as strings.
+/**
+  @brief
+  The entry ID right after id, empty if there is none.
 */
-int ha_redis::write_row(uchar *) {
-    DBUG_ENTER("ha_redis::write_row");
-    char attr_buf[1024];
-    std::string record_str = "";
-
-    ha_statistic_increment(&System_status_var::ha_write_count);
+static std::string redis_stream_next_id(const std::string &id) {
+    ulonglong key, seq;
+    redis_stream_parse_id(id, &key, &seq);
+    if (seq < ULLONG_MAX) {
+        return redis_stream_id(key, seq + 1);
+    }
+    return key < ULLONG_MAX ? redis_stream_id(key + 1, 0) : "";
+}
 
-    String attribute(attr_buf, sizeof(attr_buf), &my_charset_bin);
-    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->read_set);
+/**
+  @brief
+  The entry ID right before id, empty if there is none.
+*/
+static std::string redis_stream_prev_id(const std::string &id) {
+    ulonglong key, seq;
+    redis_stream_parse_id(id, &key, &seq);
+    if (seq > 0) {
+        return redis_stream_id(key, seq - 1);
+    }
+    return key > 0 ? redis_stream_id(key - 1, ULLONG_MAX) : "";
+}
 
-    for(Field **field = table->field; *field; field++) {
-        if((*field)->is_null()) {
-            record_str += ",";
-            continue;
+/**
+  @brief
+  All the redis keys a table is stored in. Used to drop and rename tables.
+  For a table in the bucket layout these include all the buckets up to the
+  last row id, which is read on conn.
+*/
+static Redis_args redis_table_keys(redisContext *conn, const std::string &table_name) {
+    Redis_args keys = {table_name, redis_index_name(table_name), redis_blob_name(table_name),
+                       redis_auto_inc_name(table_name), redis_checksum_name(table_name),
+                       redis_free_name(table_name), redis_stream_last_name(table_name)};
+
+    // a table in the list layout answers WRONGTYPE
+    redisReply *rr = redis_command_args(conn, {"HGET", table_name, "id"});
+    if (rr && rr->type == REDIS_REPLY_STRING) {
+        ulonglong last = strtoull(rr->str, NULL, 10);
+        for (ulonglong b = 0; b <= last / REDIS_BUCKET_ROWS; b++) {
+            keys.push_back(redis_bucket_name(table_name, b));
         }
-        const char *p;
-        const char *end;
+    }
+    if (rr) {
+        freeReplyObject(rr);
+    }
+    return keys;
+}
 
-        (*field)->val_str(&attribute, &attribute);
-        p = attribute.ptr();
-        end = attribute.length() + p;
+/**
+  @brief
+  Connect to the primary Redis server.
+*/
+static redisContext *redis_connect() {
+    return redis_connect_to(srv_host, (int)srv_port);
+}
 
-        for(; p < end; p++) {
-            record_str += *p;
+/**
+  @brief
+  The engine's data attached to a THD, created on first use if create is set.
+*/
+static Redis_trx *get_trx(THD *thd, bool create = false) {
+    Redis_trx *t = static_cast<Redis_trx *>(thd_get_ha_data(thd, redis_hton));
+    if (t == NULL && create) {
+        t = new (std::nothrow) Redis_trx;
+        if (t != NULL) {
+            thd_set_ha_data(thd, redis_hton, t);
         }
-        record_str += ",";
     }
-    tmp_restore_column_map(table->read_set, org_bitmap);
+    return t;
+}
 
-    std::string cmd = "RPUSH " + share->table_name += " " + record_str;
-    redisReply *ret = (redisReply *)redisCommand(c, cmd.c_str());
-    if(ret) {
-        freeReplyObject(ret);
+/**
+  @brief
+  What a buffered write leaves of the row it writes: the row (NULL for a
+  delete), the index key the row had and the one it gets ('' for none).
+  args are the EVALSHA arguments of the write.
+*/
+static void redis_write_effect(redis_script_id script, const Redis_args &args,
+                               const std::string **row, const std::string **old_key,
+                               const std::string **new_key) {
+    static const std::string none;
+    size_t argv = 3 + std::stoul(args[2]);
+    switch (script) {
+        case REDIS_SCRIPT_UPDATE:
+        case REDIS_SCRIPT_BUCKET_UPDATE:
+            *row = &args[argv + 2];
+            *old_key = &args[argv + 3];
+            *new_key = &args[argv + 4];
+            break;
+        case REDIS_SCRIPT_DELETE:
+        case REDIS_SCRIPT_BUCKET_DELETE:
+            *row = NULL;
+            *old_key = &args[argv + 2];
+            *new_key = &none;
+            break;
+        default:  // inserts and replaces
+            *row = &args[argv];
+            *old_key = &none;
+            *new_key = &args[argv + 1];
+            break;
     }
-
-    stats.records++;
-    DBUG_RETURN(0);
 }
 
 /**
   @brief
-  Yes, update_row() does what you expect, it updates a row. old_data will have
-  the previous row record in it, while new_data will have the newest data in it.
-  Keep in mind that the server can do updates based on ordering if an ORDER BY
-  clause was used. Consecutive ordering is not guaranteed.
+  Buffer a write. position is the position of the row it writes, 0 for a
+  row of a list table whose position only EXEC decides. The write is
+  found by the index keys it writes and by its position; entries of
+  writes thrown away by rollback_statement() are checked when found.
 */
-int ha_redis::update_row(const uchar *, uchar *) {
-    DBUG_ENTER("ha_redis::write_row");
-    ha_statistic_increment(&System_status_var::ha_update_count);
-    char attr_buf[1024];
-    std::string record_str = "";
-    String attribute(attr_buf, sizeof(attr_buf), &my_charset_bin);
-    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->read_set);
-
-    for(Field **field = table->field; *field; field++) {
-        const char *p;
-        const char *end;
-
-        if(!(*field)->is_null()) {
-            (*field)->val_str(&attribute, &attribute);
+void Redis_trx::add(redis_script_id script, const Redis_args &keys,
+                    const Redis_args &argv, ulonglong position) {
+    size_t i = writes.size();
+    writes.push_back({script, redis_evalsha_args(script, keys, argv), position, 0, 0});
+    const std::string &table = keys[0];
+    if (!keys[1].empty()) {
+        const std::string *row, *old_key, *new_key;
+        redis_write_effect(script, writes[i].args, &row, &old_key, &new_key);
+        if (!old_key->empty()) {
+            keyed[table + '\0' + *old_key].push_back(i);
+        }
+        if (!new_key->empty() && *new_key != *old_key) {
+            keyed[table + '\0' + *new_key].push_back(i);
+        }
+    }
+    if (position) {
+        placed[table + '\0' + std::to_string(position)].push_back(i);
+    }
+}
 
-            p = attribute.ptr();
-            end = attribute.length() + p;
+void Redis_trx::discard() {
+    writes.clear();
+    keyed.clear();
+    placed.clear();
+    stmt_mark = 0;
+    statement = 1;
+}
 
-            for(; p < end; p++) {
-                record_str += *p;
-            }
+/**
+  @brief
+  Throw away the writes of the current statement, and bring back the
+  writes it superseded.
+*/
+void Redis_trx::rollback_statement() {
+    writes.resize(stmt_mark);
+    for (Write &w : writes) {
+        if (w.dropped == statement) {
+            w.dropped = 0;
+            w.next = 0;
         }
-        record_str += ",";
     }
-    tmp_restore_column_map(table->read_set, org_bitmap);
+}
 
-    std::string cmd = "LSET " + share->table_name += " " + std::to_string(current_position-1) + " " + record_str;
-    redisReply *ret = (redisReply *)redisCommand(c, cmd.c_str());
-    if(ret) {
-        freeReplyObject(ret);
+/**
+  @brief
+  The row of a table which holds an index key after the buffered writes,
+  false if none of them wrote the key. found->row is NULL if the key was
+  deleted or given up. Not for stream tables.
+*/
+bool Redis_trx::find_key(const std::string &table, const std::string &key,
+                         Row *found) const {
+    auto it = keyed.find(table + '\0' + key);
+    if (it == keyed.end()) {
+        return false;
     }
-
-    DBUG_RETURN(0);
+    for (size_t j = it->second.size(); j-- > 0;) {
+        size_t i = it->second[j];
+        if (i >= writes.size() || writes[i].dropped || writes[i].args[3] != table) {
+            continue;
+        }
+        const Write &w = writes[i];
+        const std::string *row, *old_key, *new_key;
+        redis_write_effect(w.script, w.args, &row, &old_key, &new_key);
+        if (*new_key == key || *old_key == key) {
+            ulonglong position = w.position ? w.position : (REDIS_TRX_POSITION | i);
+            *found = {position, *new_key == key ? row : NULL, w.script, &w.args};
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
   @brief
-  This will delete a row.
-  This set the value ".". And After setting all deleting rows Actually delete them in rnd_end().
-  This is temporal implimentation.
+  The row of a table at a position after the buffered writes, false if
+  none of them wrote it. A row inserted into a list table has the position
+  REDIS_TRX_POSITION | the number of its write until commit; a later
+  statement which changes it supersedes that write (see supersede()).
 */
-int ha_redis::delete_row(const uchar *) {
-    // (current_position-1)に"."をセットする
-    ha_statistic_increment(&System_status_var::ha_delete_count);
-    std::string cmd = "LSET " + share->table_name += " " + std::to_string(current_position-1) + " .";
-    redisReply *ret = (redisReply *)redisCommand(c, cmd.c_str());
-    if(ret) {
-        freeReplyObject(ret);
+bool Redis_trx::find_position(const std::string &table, ulonglong position,
+                              Row *found) const {
+    if (position & REDIS_TRX_POSITION) {
+        size_t i = position & ~REDIS_TRX_POSITION;
+        while (i < writes.size() && writes[i].dropped && writes[i].next) {
+            i = writes[i].next;
+        }
+        if (i >= writes.size() || writes[i].dropped) {
+            *found = {position, NULL, REDIS_SCRIPT_INSERT, NULL};
+            return true;
+        }
+        const Write &w = writes[i];
+        *found = {REDIS_TRX_POSITION | i, &w.args[3 + std::stoul(w.args[2])], w.script,
+                  &w.args};
+        return true;
     }
-
-    return 0;
+    auto it = placed.find(table + '\0' + std::to_string(position));
+    if (it == placed.end()) {
+        return false;
+    }
+    for (size_t j = it->second.size(); j-- > 0;) {
+        size_t i = it->second[j];
+        if (i >= writes.size() || writes[i].dropped || writes[i].position != position ||
+            writes[i].args[3] != table) {
+            continue;
+        }
+        const Write &w = writes[i];
+        const std::string *row, *old_key, *new_key;
+        redis_write_effect(w.script, w.args, &row, &old_key, &new_key);
+        *found = {position, row, w.script, &w.args};
+        return true;
+    }
+    return false;
 }
 
 /**
   @brief
-  Positions an index cursor to the index specified in the handle. Fetches the
-  row if available. If the key value is null, begin at the first key of the
-  index.
+  Drop the buffered insert of a row which has no position yet, because
+  the current statement deletes the row (moved false) or writes it again
+  with the next write added (moved true).
+
+  @return the position of the row after the next write.
 */
-int ha_redis::index_read_map(uchar *, const uchar *, key_part_map, enum ha_rkey_function) {
-    int rc;
-    // DBUG_TRACE;
-    rc = HA_ERR_WRONG_COMMAND;
-    return rc;
+ulonglong Redis_trx::supersede(ulonglong position, bool moved) {
+    Write &w = writes[position & ~REDIS_TRX_POSITION];
+    w.dropped = statement;
+    w.next = moved ? writes.size() : 0;
+    return REDIS_TRX_POSITION | writes.size();
 }
 
 /**
   @brief
-  Used to read forward through the index.
+  Whether an earlier statement of the transaction wrote to a table. Scans
+  of it wouldn't see those writes, so they are refused (see
+  ha_redis::check_own_writes()).
 */
-int ha_redis::index_next(uchar *) {
-    int rc;
-    // DBUG_TRACE;
-    rc = HA_ERR_WRONG_COMMAND;
-    return rc;
+bool Redis_trx::wrote_before(const std::string &table) const {
+    for (size_t i = 0; i < stmt_mark; i++) {
+        // EVALSHA sha numkeys KEYS[1] ...
+        if (writes[i].args[3] == table) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+  @brief
+  Append to the KEYS and ARGV of REDIS_SCRIPT_VERIFY what a buffered write
+  checks before it writes. args are the EVALSHA arguments of the write.
+*/
+static void redis_verify_args(redis_script_id script, const Redis_args &args,
+                              Redis_args *keys, Redis_args *verify) {
+    size_t numkeys = std::stoul(args[2]);
+    size_t argv = 3 + numkeys;
+    const std::string none;
+    const std::string first = std::to_string(keys->size() + 1);
+    const char *layout = "list";
+    // a bucket script also has the row id of a new row and the row which
+    // held the key (see REDIS_SCRIPT_BUCKET_INSERT)
+    bool buckets = false;
+    switch (script) {
+        case REDIS_SCRIPT_BUCKET_INSERT:
+        case REDIS_SCRIPT_BUCKET_UPDATE:
+        case REDIS_SCRIPT_BUCKET_DELETE:
+        case REDIS_SCRIPT_BUCKET_REPLACE:
+            layout = "bucket";
+            buckets = true;
+            break;
+        case REDIS_SCRIPT_STREAM_INSERT:
+        case REDIS_SCRIPT_STREAM_DELETE:
+            layout = "stream";
+            break;
+        default:
+            break;
+    }
+    keys->insert(keys->end(), args.begin() + 3, args.begin() + argv);
+    Redis_args check;
+    switch (script) {
+        case REDIS_SCRIPT_INSERT:
+        case REDIS_SCRIPT_BUCKET_INSERT:
+        case REDIS_SCRIPT_STREAM_INSERT:
+            check = {"insert", layout, first, buckets ? args[argv + 3] : none, args[argv],
+                     none, args[argv + 1], buckets ? args[argv + 4] : none};
+            break;
+        case REDIS_SCRIPT_UPDATE:
+        case REDIS_SCRIPT_BUCKET_UPDATE:
+            check = {"update", layout, first, args[argv], args[argv + 1],
+                     args[argv + 3], args[argv + 4], buckets ? args[argv + 7] : none};
+            break;
+        case REDIS_SCRIPT_DELETE:
+        case REDIS_SCRIPT_BUCKET_DELETE:
+        case REDIS_SCRIPT_STREAM_DELETE:
+            check = {"delete", layout, first, args[argv], args[argv + 1],
+                     args[argv + 2], none, none};
+            break;
+        default:
+            check = {"replace", layout, first, buckets ? args[argv + 3] : none, args[argv],
+                     none, args[argv + 1], buckets ? args[argv + 4] : none};
+            break;
+    }
+    verify->insert(verify->end(), check.begin(), check.end());
+}
+
+bool Redis_trx::connect() {
+    if (conn != NULL && !conn->err) {
+        redis_apply_timeout(conn);
+        return true;
+    }
+    if (conn) {
+        redisFree(conn);
+    }
+    pending = 0;
+    conn = redis_connect();
+    return conn != NULL && !conn->err;
+}
+
+/**
+  @brief
+  Check that every buffered write would succeed: WATCH the keys the writes
+  touch, then run REDIS_SCRIPT_VERIFY, in one pipeline.
+
+  @param load    load the scripts the writes use in the same pipeline
+  @param lost    set if the connection failed
+
+  @return the error of the first write which would fail, 0 if none would.
+          The WATCHes are kept only if it is 0.
+*/
+int Redis_trx::verify(bool load, bool *lost) {
+    DBUG_ENTER("Redis_trx::verify");
+    bool used[REDIS_SCRIPT_MAX] = {false};
+    std::set<std::string> keys;
+    Redis_args check_keys, check_argv;
+    for (const Write &w : writes) {
+        used[w.script] = true;
+        keys.insert(w.args[3]);
+        if (!w.args[4].empty()) {
+            keys.insert(w.args[4]);
+        }
+        redis_verify_args(w.script, w.args, &check_keys, &check_argv);
+    }
+    used[REDIS_SCRIPT_VERIFY] = true;
+    Redis_args check = redis_evalsha_args(REDIS_SCRIPT_VERIFY, check_keys, check_argv);
+
+    size_t queued = 0;  // replies to read before the one of REDIS_SCRIPT_VERIFY
+    for (int i = 0; load && i < REDIS_SCRIPT_MAX; i++) {
+        if (used[i]) {
+            // also loads the scripts run by EXEC, where a NOSCRIPT couldn't be retried
+            redis_append_script_load(conn, (redis_script_id)i);
+            queued++;
+        }
+    }
+    Redis_args watch = {"WATCH"};
+    watch.insert(watch.end(), keys.begin(), keys.end());
+    redis_append_args(conn, watch);
+    redis_append_args(conn, check);
+    queued += 1 + pending;
+    pending = 0;
+
+    int rc = 0;
+    redisReply *reply = NULL;
+    for (size_t i = 0; i < queued; i++) {
+        if (redisGetReply(conn, (void **)&reply) != REDIS_OK) {
+            *lost = true;
+            DBUG_RETURN(HA_ERR_NO_CONNECTION);
+        }
+        if (reply->type == REDIS_REPLY_ERROR) {
+            rc = HA_ERR_INTERNAL_ERROR;
+        }
+        freeReplyObject(reply);
+    }
+    if (redisGetReply(conn, (void **)&reply) != REDIS_OK) {
+        *lost = true;
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (reply->type != REDIS_REPLY_ARRAY) {
+        rc = HA_ERR_INTERNAL_ERROR;
+    } else if (reply->elements == 2 && !rc) {
+        if (reply->element[1]->integer == -2) {
+            rc = HA_ERR_REDIS_STREAM_ORDER;
+        } else if (reply->element[1]->integer < 0) {
+            rc = HA_ERR_FOUND_DUPP_KEY;
+        } else {
+            redis_status.conflicts++;
+            rc = HA_ERR_RECORD_CHANGED;
+        }
+    }
+    freeReplyObject(reply);
+
+    if (rc) {
+        redisAppendCommand(conn, "UNWATCH");
+        pending++;
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Apply the verified writes: MULTI, writes..., EXEC [, WAIT].
+
+  @param raced  set if EXEC didn't run because a WATCHed key changed
+                since verify()
+*/
+int Redis_trx::exec(THD *thd, uint wait_replicas, ulong wait_timeout, bool *raced) {
+    DBUG_ENTER("Redis_trx::exec");
+    redisAppendCommand(conn, "MULTI");
+    for (const Write &w : writes) {
+        redis_append_args(conn, w.args);
+    }
+    redisAppendCommand(conn, "EXEC");
+    if (wait_replicas > 0) {
+        redisAppendCommand(conn, "WAIT %u %lu", wait_replicas, wait_timeout);
+    }
+
+    int rc = 0;
+    redisReply *reply = NULL;
+    size_t queued = 1 + writes.size();  // replies before the one of EXEC
+    for (size_t i = 0; i < queued; i++) {
+        if (redisGetReply(conn, (void **)&reply) != REDIS_OK) {
+            DBUG_RETURN(HA_ERR_NO_CONNECTION);
+        }
+        if (reply->type == REDIS_REPLY_ERROR) {
+            rc = HA_ERR_INTERNAL_ERROR;
+        }
+        freeReplyObject(reply);
+    }
+
+    if (redisGetReply(conn, (void **)&reply) != REDIS_OK) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (reply->type == REDIS_REPLY_NIL) {
+        // a WATCHed key was written by another session, nothing was applied
+        *raced = true;
+    } else if (reply->type != REDIS_REPLY_ARRAY || reply->elements < writes.size()) {
+        // EXECABORT: a command was rejected while queued, nothing was applied
+        rc = HA_ERR_INTERNAL_ERROR;
+    } else {
+        // verified, so a failure here is one the verification doesn't know of
+        for (size_t i = 0; i < writes.size() && !rc; i++) {
+            redisReply *r = reply->element[i];
+            if (r->type != REDIS_REPLY_INTEGER || r->integer <= 0) {
+                rc = HA_ERR_INTERNAL_ERROR;
+            }
+        }
+    }
+    freeReplyObject(reply);
+
+    if (wait_replicas > 0) {
+        if (redisGetReply(conn, (void **)&reply) != REDIS_OK) {
+            DBUG_RETURN(HA_ERR_NO_CONNECTION);
+        }
+        // the writes are already applied, so only warn
+        if (!*raced && reply->type == REDIS_REPLY_INTEGER && reply->integer < wait_replicas) {
+            push_warning_printf(thd, Sql_condition::SL_WARNING, ER_GET_ERRMSG,
+                                ER_THD(thd, ER_GET_ERRMSG), (int)reply->integer,
+                                "fewer replicas than redis_commit_wait_replicas "
+                                "acknowledged the commit", "REDIS");
+        }
+        freeReplyObject(reply);
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Apply the buffered writes, all of them or none.
+  The buffer is empty afterwards, whatever the result.
+
+  @details
+  A write script which fails inside EXEC doesn't undo the writes before
+  it, so the writes are checked first: verify() WATCHes the keys they
+  touch and runs REDIS_SCRIPT_VERIFY, which fails on the first write
+  whose row changed or whose key is taken, then exec() applies them.
+  The WATCH only spans these two round trips; if another session writes
+  to one of the tables in between, EXEC doesn't run and the writes are
+  verified again, up to REDIS_TRX_ATTEMPTS times.
+*/
+int Redis_trx::flush(THD *thd, uint wait_replicas, ulong wait_timeout) {
+    DBUG_ENTER("Redis_trx::flush");
+    writes.erase(std::remove_if(writes.begin(), writes.end(),
+                                [](const Write &w) { return w.dropped != 0; }),
+                 writes.end());
+    if (writes.empty()) {
+        DBUG_RETURN(0);
+    }
+    if (!connect()) {
+        discard();
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+
+    int rc = 0;
+    bool raced = false;
+    for (uint attempt = 1; attempt <= REDIS_TRX_ATTEMPTS; attempt++) {
+        bool lost = false;
+        raced = false;
+        rc = verify(attempt == 1, &lost);
+        if (lost) {
+            goto conn_err;
+        }
+        if (!rc) {
+            rc = exec(thd, wait_replicas, wait_timeout, &raced);
+            if (rc == HA_ERR_NO_CONNECTION) {
+                goto conn_err;
+            }
+        }
+        if (!raced) {
+            break;
+        }
+    }
+    if (raced) {
+        redis_status.conflicts++;
+        rc = HA_ERR_RECORD_CHANGED;
+    }
+
+    if (!rc) {
+        read_point.last_write = my_micro_time();
+    }
+    discard();
+    DBUG_RETURN(rc);
+
+conn_err:
+    if (redis_timed_out(conn)) {
+        redis_io_status.deadline_expirations++;
+    }
+    redisFree(conn);
+    conn = NULL;
+    pending = 0;
+    discard();
+    DBUG_RETURN(HA_ERR_NO_CONNECTION);
+}
+
+/**
+  @brief
+  Commit a statement or a transaction. At the end of a statement inside
+  BEGIN ... COMMIT (or autocommit=0) the writes stay buffered.
+*/
+static int redis_commit(handlerton *, THD *thd, bool commit_trx) {
+    DBUG_ENTER("redis_commit");
+    Redis_trx *trx = get_trx(thd);
+    int rc = 0;
+
+    if (trx) {
+        if (commit_trx || !thd_test_options(thd, OPTION_NOT_AUTOCOMMIT | OPTION_BEGIN)) {
+            rc = trx->flush(thd, THDVAR(thd, commit_wait_replicas),
+                            THDVAR(thd, commit_wait_timeout));
+        } else {
+            trx->end_statement();
+        }
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Rollback a statement or a transaction by discarding its buffered writes.
+*/
+static int redis_rollback(handlerton *, THD *thd, bool rollback_trx) {
+    DBUG_ENTER("redis_rollback");
+    Redis_trx *trx = get_trx(thd);
+
+    if (trx) {
+        if (rollback_trx || !thd_test_options(thd, OPTION_NOT_AUTOCOMMIT | OPTION_BEGIN)) {
+            trx->discard();
+        } else {
+            trx->rollback_statement();
+        }
+    }
+    DBUG_RETURN(0);
+}
+
+static int redis_close_connection(handlerton *, THD *thd) {
+    DBUG_ENTER("redis_close_connection");
+    delete get_trx(thd);
+    thd_set_ha_data(thd, redis_hton, NULL);
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Redis of simple lock controls. The "share" it creates is a
+  structure we will pass to each redis handler. Do you have to have
+  one of these? Well, you have pieces that are used for locking, and
+  they are needed to function.
+*/
+Redis_share *ha_redis::get_share() {
+    Redis_share *tmp_share;
+    DBUG_ENTER("ha_redis::get_share()");
+
+    lock_shared_ha_data();
+    if (!(tmp_share = static_cast<Redis_share *>(get_ha_share_ptr()))) {
+        tmp_share = new Redis_share;
+        if (!tmp_share) goto err;
+        // the codec depends on the TABLE_SHARE only, compile it once
+        tmp_share->codec.compile(table);
+
+        set_ha_share_ptr(static_cast<Handler_share *>(tmp_share));
+    }
+    err:
+    unlock_shared_ha_data();
+    DBUG_RETURN(tmp_share);
+}
+
+static handler *redis_create_handler(handlerton *hton, TABLE_SHARE *table, bool, MEM_ROOT *mem_root) {
+    return new (mem_root) ha_redis(hton, table);
+}
+
+ha_redis::ha_redis(handlerton *hton, TABLE_SHARE *table_arg)
+    : handler(hton, table_arg),
+    share(NULL),
+    mirror(hton == redis_secondary_hton),
+    live_checksum(table_arg && !mirror && redis_table_option(table_arg, "redis_checksum") == "on"),
+    c(NULL),
+    primary(NULL),
+    replica(NULL),
+    replica_index(-1),
+    hedge(NULL),
+    current_hedged(false),
+    current_position(0),
+    scan_position(0),
+    null_lookup(false),
+    dup_position(0),
+    stream_reverse(false),
+    stream_key_read(0),
+    bulk_insert(false),
+    write_behind(false),
+    behind_queued(false),
+    write_can_replace(false),
+    scan_reply(NULL),
+    scan_element(0),
+    trx(NULL),
+    counted_cond(NULL),
+    counted(0) {
+}
+
+/*
+  List of all system tables specific to the SE.
+  Array element would look like below,
+     { "<database_name>", "<system table name>" },
+  The last element MUST be,
+     { (const char*)NULL, (const char*)NULL }
+
+  This array is optional, so every SE need not implement it.
+*/
+static st_handler_tablename ha_redis_system_tables[] = {
+        {(const char *)NULL, (const char *)NULL}
+};
+
+/**
+  @brief Check if the given db.tablename is a system table for this SE.
+
+  @param db                         Database name to check.
+  @param table_name                 table name to check.
+  @param is_sql_layer_system_table  if the supplied db.table_name is a SQL
+                                    layer system table.
+
+  @return
+    @retval true   Given db.table_name is supported system table.
+    @retval false  Given db.table_name is not a supported system table.
+*/
+static bool redis_is_supported_system_table(const char *db,
+                                              const char *table_name,
+                                              bool is_sql_layer_system_table) {
+    st_handler_tablename *systab;
+
+    if (is_sql_layer_system_table) return false; // Does this SE support "ALL" SQL layer system tables ?
+
+    // Check if this is SE layer system tables
+    systab = ha_redis_system_tables;
+    while (systab && systab->db) {
+        if (systab->db == db && strcmp(systab->tablename, table_name) == 0)
+            return true;
+        systab++;
+    }
+
+    return false;
+}
+
+/**
+  @brief
+  Used for opening tables. The name will be the name of the list key in redis.
+
+  @see
+  handler::ha_open() in handler.cc
+*/
+int ha_redis::open(const char *tname, int, uint, const dd::Table *) {
+    DBUG_ENTER("ha_redis::open");
+
+    if (!(share = get_share())) return 1;
+    thr_lock_data_init(&share->lock, &lock, NULL);
+
+    primary = redis_connect();
+    if (primary != NULL && primary->err) {
+        DBUG_RETURN(-1);
+    }
+    // load the scripts once per connection, row operations call them by EVALSHA
+    if (!redis_load_scripts(primary)) {
+        redisFree(primary);
+        primary = NULL;
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    c = primary;
+
+    redis_layout layout = REDIS_LAYOUT_LIST;
+    if (mirror) {
+        // a mirror is a plain list of rows, the COMMENT is the primary table's
+        share->table_name = redis_mirror_name(get_table_name(tname));
+    } else {
+        redis_table_layout(table->s, &layout);
+        share->table_name = get_table_name(tname);
+    }
+    share->layout = layout;
+    if (mirror) {
+        // a table which wasn't loaded, or was unloaded, leaves the query to
+        // the primary engine
+        redisReply *rr = redis_call(primary, {"EXISTS", redis_mirror_loaded_name(share->table_name)},
+                                    true);
+        bool loaded = rr && rr->type == REDIS_REPLY_INTEGER && rr->integer == 1;
+        if (rr) {
+            freeReplyObject(rr);
+        }
+        if (!loaded) {
+            redisFree(primary);
+            primary = NULL;
+            c = NULL;
+            DBUG_RETURN(rr ? HA_ERR_GENERIC : HA_ERR_NO_CONNECTION);
+        }
+    }
+    // the index of a stream table is the order of the stream itself
+    share->index_name = (table->s->keys > 0 && layout != REDIS_LAYOUT_STREAM && !mirror)
+                            ? redis_index_name(share->table_name) : "";
+    share->blob_name = redis_blob_name(share->table_name);
+    share->auto_inc_name = redis_auto_inc_name(share->table_name);
+    share->free_name = (layout == REDIS_LAYOUT_LIST) ? redis_free_name(share->table_name) : "";
+    share->last_name =
+        (layout == REDIS_LAYOUT_STREAM) ? redis_stream_last_name(share->table_name) : "";
+    share->stream_maxlen =
+        strtoull(redis_table_option(table->s, "redis_stream_maxlen").c_str(), NULL, 10);
+    share->stream_retention =
+        strtoull(redis_table_option(table->s, "redis_stream_retention").c_str(), NULL, 10);
+    if (!mirror) {
+        share->ttl = strtoull(redis_table_option(table->s, "redis_ttl").c_str(), NULL, 10);
+        redis_expire_field(table->s, &share->expire_field);
+        share->write_behind = redis_table_option(table->s, "redis_write_behind") == "on";
+        if (live_checksum) {
+            share->checksum_name = redis_checksum_name(share->table_name);
+        }
+    }
+    if (layout == REDIS_LAYOUT_STREAM) {
+        // an entry ID (see position())
+        ref_length = 2 * sizeof(ulonglong);
+    }
+
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Closes a table.
+*/
+int ha_redis::close(void) {
+    // DBUG_TRACE;
+    // FLUSH TABLES: what the table has queued is written before it returns
+    if (share) {
+        redis_write_behind_flush_to(share->behind_mark.load());
+    }
+    free_scan_reply();
+    if (primary) {
+        redisFree(primary);
+        primary = NULL;
+    }
+    if (replica) {
+        redisFree(replica);
+        replica = NULL;
+    }
+    c = NULL;
+    return 0;
+}
+
+/**
+  @brief
+  Serialize the current row (table->record[0]) with the table's codec
+  (see redis_codec.h). Long BLOB values are put into blobs instead.
+*/
+void ha_redis::pack_row(std::string *record, Redis_blob_writes *blobs) {
+    char attr_buf[1024];
+    String attribute(attr_buf, sizeof(attr_buf), &my_charset_bin);
+    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->read_set);
+
+    share->codec.encode(table, table->record[0], record, &attribute, blobs);
+    if (share->expires() && share->layout == REDIS_LAYOUT_LIST &&
+        !share->index_name.empty()) {
+        // the scripts reclaiming the row once it has expired delete its
+        // index entry by this key (see RECLAIM in redis_scripts.cc)
+        std::string key;
+        pack_key(table->record[0], &key);
+        Redis_row_codec::set_expiry(record, row_expiry(), &key);
+    } else if (share->expires()) {
+        Redis_row_codec::set_expiry(record, row_expiry());
+    }
+    tmp_restore_column_map(table->read_set, org_bitmap);
+}
+
+/**
+  @brief
+  Time the current row expires at, in milliseconds since the epoch: the
+  value of its redis_expire_column or, if that is NULL, redis_ttl seconds
+  from now. 0 if the row never expires.
+*/
+ulonglong ha_redis::row_expiry() {
+    if (share->expire_field >= 0) {
+        Field *field = table->field[share->expire_field];
+        struct timeval tv;
+        int warnings = 0;
+        if (!field->is_null() && !field->get_timestamp(&tv, &warnings)) {
+            // a time before the epoch has passed already
+            return tv.tv_sec > 0 ? (ulonglong)tv.tv_sec * 1000 + tv.tv_usec / 1000 : 1;
+        }
+    }
+    if (share->ttl > 0) {
+        return my_micro_time() / 1000 + share->ttl * 1000;
+    }
+    return 0;
+}
+
+/**
+  @brief
+  Whether a row fetched from redis has expired. Redis drops expired rows
+  of bucket tables by itself, list tables keep them until a scan or count
+  on the primary reclaims them (see reclaims()) or an insert of the same
+  key takes their place, so readers skip them.
+*/
+bool ha_redis::row_expired(const char *row, size_t length) const {
+    ulonglong at = Redis_row_codec::expiry(row, length);
+    return at != 0 && at <= my_micro_time() / 1000;
+}
+
+/**
+  @brief
+  Whether the scripts reading the rows of this table turn the expired
+  rows they meet into tombstones and free their positions (see RECLAIM in
+  redis_scripts.cc). Only list tables need it, and only the primary can
+  be written to.
+*/
+bool ha_redis::reclaims() const {
+    return share->layout == REDIS_LAYOUT_LIST && share->expires() && c == primary;
+}
+
+/**
+  @brief
+  Values longer than this are stored out of line, 0 if none is. XTRIM
+  and the expiry of rows can't delete out-of-line values, so stream
+  tables and tables whose rows expire keep them inline.
+*/
+size_t ha_redis::blob_limit() const {
+    if (share->layout == REDIS_LAYOUT_STREAM || share->expires()) {
+        return 0;
+    }
+    return srv_blob_inline_limit;
+}
+
+/**
+  @brief
+  ARGV of REDIS_SCRIPT_COMPACT for the table.
+*/
+Redis_args ha_redis::compact_argv() const {
+    return {share->expires() ? "expiry" : ""};
+}
+
+/**
+  @brief
+  Store a row fetched from redis into buf, which is table->record[0] or
+  another record buffer of the table.
+  The caller sets the write_set so that every field can be stored.
+
+  @details
+  BLOB columns point into row, so it must be current_row (or
+  previous_row), which live until the next row is read. Out-of-line
+  values are taken from blobs, filled by fetch_blobs().
+*/
+int ha_redis::unpack_row(uchar *buf, const char *row, size_t length,
+                         Redis_blob_cursor *blobs) {
+    return share->codec.decode(table, buf, row, length, blobs);
+}
+
+/**
+  @brief
+  Read the out-of-line values of a row, or of a scan batch when row is
+  NULL, of the columns in the read_set by one HMGET into arena.
+*/
+int ha_redis::fetch_blobs(redisContext *conn, Redis_reply_arena *arena, const char *row,
+                          size_t length, Redis_blob_cursor *blobs) {
+    DBUG_ENTER("ha_redis::fetch_blobs");
+    Redis_args args = {"HMGET", share->blob_name};
+
+    blobs->reset(NULL);
+    if (row) {
+        share->codec.blob_ids(row, length, table->read_set, &args);
+    } else {
+        for (size_t i = 2; i < scan_reply->elements; i += 2) {
+            const redisReply *r = scan_reply->element[i];
+            share->codec.blob_ids(r->str, r->len, table->read_set, &args);
+        }
+    }
+    if (args.size() == 2) {
+        DBUG_RETURN(0);
+    }
+
+    redisReply *reply = redis_call_arena(conn, arena, args);
+    if (!reply) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (reply->type != REDIS_REPLY_ARRAY) {
+        DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
+    blobs->reset(reply);
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Build the key stored in the index hash for a row: the sort keys of the
+  key parts, so that values which are equal in the column collation
+  (e.g. 'a' and 'A') hit the same hash field.
+
+  @details
+  NULLs in a unique key are all distinct, so a key with a NULL part gets no
+  index entry: key is left empty and true is returned. With null_flags the
+  key is built anyway, a byte before each nullable part telling whether it
+  is NULL, to compare keys with NULL parts (see index_read_map()).
+*/
+bool ha_redis::pack_key(const uchar *record, std::string *key, bool null_flags) {
+    KEY *key_info = table->key_info;
+    ptrdiff_t offset = record - table->record[0];
+    bool has_null = false;
+
+    key->clear();
+    for (uint i = 0; i < key_info->user_defined_key_parts; i++) {
+        Field *field = key_info->key_part[i].field;
+        bool is_null = field->is_null_in_record(record);
+        has_null |= is_null;
+        if (null_flags && field->real_maybe_null()) {
+            key->push_back(is_null ? 1 : 0);
+        }
+        if (is_null) {
+            continue;
+        }
+        size_t start = key->length();
+        size_t length = field->sort_length();
+
+        key->resize(start + length);  // zero filled
+        field->move_field_offset(offset);
+        field->make_sort_key(reinterpret_cast<uchar *>(&(*key)[start]), length);
+        field->move_field_offset(-offset);
+    }
+    if (has_null && !null_flags) {
+        key->clear();
+    }
+    return has_null;
+}
+
+/**
+  @brief
+  KEYS of the row scripts: the list, the index ('' if the table has none),
+  the out-of-line values, the auto increment counter, the live checksum
+  ('' if the table has none), the free positions of a list table and the
+  last entry ID of a stream table.
+*/
+Redis_args ha_redis::row_keys() const {
+    return {share->table_name, share->index_name, share->blob_name, share->auto_inc_name,
+            share->checksum_name, share->free_name, share->last_name};
+}
+
+/**
+  @brief
+  KEYS of a write script for row id: row_keys(), followed in a bucket table
+  by the bucket of the row and the bucket of row held, which held the index
+  key the row gets when the handler looked ('' for none, see
+  REDIS_SCRIPT_BUCKET_INSERT).
+*/
+Redis_args ha_redis::write_keys(ulonglong id, ulonglong held) const {
+    Redis_args keys = row_keys();
+    if (share->layout == REDIS_LAYOUT_BUCKETS) {
+        keys.push_back(redis_bucket_name(share->table_name, id / REDIS_BUCKET_ROWS));
+        keys.push_back(held ? redis_bucket_name(share->table_name, held / REDIS_BUCKET_ROWS)
+                            : "");
+    }
+    return keys;
+}
+
+/**
+  @brief
+  KEYS of a script reading up to rows rows of a table from bucket first on:
+  the table, followed in a bucket table by the buckets holding those rows.
+*/
+Redis_args ha_redis::chunk_keys(ulonglong first, ulonglong rows) const {
+    Redis_args keys = {share->table_name};
+    if (share->layout == REDIS_LAYOUT_BUCKETS) {
+        ulonglong n = (rows + REDIS_BUCKET_ROWS - 1) / REDIS_BUCKET_ROWS;
+        for (ulonglong b = first; b < first + n; b++) {
+            keys.push_back(redis_bucket_name(share->table_name, b));
+        }
+    }
+    return keys;
+}
+
+/**
+  @brief
+  The script doing what a row script of the list layout does in the layout
+  of this table.
+*/
+redis_script_id ha_redis::layout_script(redis_script_id script) const {
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        switch (script) {
+            case REDIS_SCRIPT_FETCH:
+                return REDIS_SCRIPT_STREAM_FETCH;
+            case REDIS_SCRIPT_INSERT:
+                return REDIS_SCRIPT_STREAM_INSERT;
+            case REDIS_SCRIPT_DELETE:
+                return REDIS_SCRIPT_STREAM_DELETE;
+            case REDIS_SCRIPT_COUNT:
+                return REDIS_SCRIPT_STREAM_COUNT;
+            default:
+                return script;
+        }
+    }
+    if (share->layout != REDIS_LAYOUT_BUCKETS) {
+        return script;
+    }
+    switch (script) {
+        case REDIS_SCRIPT_FETCH:
+            return REDIS_SCRIPT_BUCKET_FETCH;
+        case REDIS_SCRIPT_INSERT:
+            return REDIS_SCRIPT_BUCKET_INSERT;
+        case REDIS_SCRIPT_UPDATE:
+            return REDIS_SCRIPT_BUCKET_UPDATE;
+        case REDIS_SCRIPT_DELETE:
+            return REDIS_SCRIPT_BUCKET_DELETE;
+        case REDIS_SCRIPT_LOOKUP:
+            return REDIS_SCRIPT_BUCKET_LOOKUP;
+        case REDIS_SCRIPT_REPLACE:
+            return REDIS_SCRIPT_BUCKET_REPLACE;
+        case REDIS_SCRIPT_COUNT:
+            return REDIS_SCRIPT_BUCKET_COUNT;
+        default:
+            return script;
+    }
+}
+
+ulong ha_redis::index_flags(uint, uint, bool) const {
+    if (share && share->layout == REDIS_LAYOUT_STREAM) {
+        return HA_READ_NEXT | HA_READ_PREV | HA_READ_ORDER | HA_READ_RANGE |
+               HA_KEY_SCAN_NOT_ROR;
+    }
+    return HA_ONLY_WHOLE_INDEX | HA_KEY_SCAN_NOT_ROR;
+}
+
+/**
+  @brief
+  Key of a row of a stream table: the sort key of its index column read
+  as a big-endian number, so that keys sort like the column values.
+  It is the first part of the row's entry ID.
+*/
+ulonglong ha_redis::stream_key(const uchar *record) {
+    Field *field = table->key_info->key_part[0].field;
+    size_t length = field->sort_length();  // at most 8 (see create())
+    uchar sort_key[sizeof(ulonglong)];
+    ptrdiff_t offset = record - table->record[0];
+
+    field->move_field_offset(offset);
+    field->make_sort_key(sort_key, length);
+    field->move_field_offset(-offset);
+
+    ulonglong key = 0;
+    for (size_t i = 0; i < length; i++) {
+        key = (key << 8) | sort_key[i];
+    }
+    return key;
+}
+
+/**
+  @brief
+  First value >= value of the sequence auto_increment_offset +
+  n * auto_increment_increment (see compute_next_insert_id()).
+*/
+static ulonglong auto_inc_align(ulonglong value, ulonglong offset, ulonglong increment) {
+    if (increment <= 1) {
+        return value;
+    }
+    if (offset > increment) {
+        offset = 0;
+    }
+    return ((value - 1 + increment - offset) / increment) * increment + offset;
+}
+
+/**
+  @brief
+  Reserve AUTO_INCREMENT values. They come from the range this server has
+  reserved from the table's counter; only when it is used up a new range
+  is reserved, by one script call. A range used up within
+  REDIS_AUTO_INC_FAST microseconds doubles the size of the next one (up to
+  REDIS_AUTO_INC_MAX_RANGE), one lasting longer than REDIS_AUTO_INC_SLOW
+  halves it, so bulk inserts take few round trips and single inserts leave
+  few gaps.
+
+  @details
+  Values of a range not used before the table is closed are lost, as with
+  innodb_autoinc_lock_mode = 2. The share's mutex isn't held during the
+  round trip: handlers which reserve ranges at the same time keep the
+  newest one for the share and use the others for their own values.
+*/
+void ha_redis::get_auto_increment(ulonglong offset, ulonglong increment,
+                                  ulonglong nb_desired_values, ulonglong *first_value,
+                                  ulonglong *nb_reserved_values) {
+    DBUG_ENTER("ha_redis::get_auto_increment");
+    // replies of pipelined inserts come first on the connection
+    if (stream_flush()) {
+        *first_value = ULLONG_MAX;
+        DBUG_VOID_RETURN;
+    }
+    Redis_auto_inc &ai = share->auto_inc;
+    ulonglong wanted = nb_desired_values ? nb_desired_values : 1;
+    ulonglong step = std::max<ulonglong>(increment, 1);
+    std::unique_lock<std::mutex> guard(ai.mutex);
+
+    ulonglong last = ai.last;  // of the range the values are taken from
+    ulonglong value = last ? auto_inc_align(ai.next, offset, increment) : 0;
+    while (last == 0 || value > last) {
+        ulonglong now = my_micro_time();
+        if (ai.last && now - ai.reserved_at < REDIS_AUTO_INC_FAST) {
+            ai.range = std::min<ulonglong>(ai.range * 2, REDIS_AUTO_INC_MAX_RANGE);
+        } else if (ai.last && now - ai.reserved_at > REDIS_AUTO_INC_SLOW) {
+            ai.range = std::max<ulonglong>(ai.range / 2, 1);
+        }
+        ulonglong n = std::max(ai.range, wanted * step);
+        Redis_args argv = {std::to_string(n), std::to_string(ai.floor)};
+        guard.unlock();
+
+        redisReply *rr = redis_eval(primary, REDIS_SCRIPT_AUTO_INC, {share->auto_inc_name},
+                                    argv);
+        if (!rr || rr->type != REDIS_REPLY_INTEGER) {
+            if (rr) {
+                freeReplyObject(rr);
+            }
+            *first_value = ULLONG_MAX;  // fails the insert with HA_ERR_AUTOINC_READ_FAILED
+            DBUG_VOID_RETURN;
+        }
+        last = rr->integer;
+        freeReplyObject(rr);
+
+        guard.lock();
+        // values inserted explicitly meanwhile aren't handed out
+        ulonglong next = std::max(last - n + 1, ai.floor + 1);
+        if (last > ai.last) {
+            ai.last = last;
+            ai.next = next;
+            ai.reserved_at = now;
+        }
+        value = auto_inc_align(next, offset, increment);
+    }
+
+    *first_value = value;
+    *nb_reserved_values = std::min((last - value) / step + 1, wanted);
+    if (last == ai.last) {
+        ai.next = value + *nb_reserved_values * step;
+    }
+    DBUG_VOID_RETURN;
+}
+
+/**
+  @brief
+  Row id of a new row of a bucket table, so that the handler can pass its
+  bucket to the write script. Ids come from the range this server has
+  reserved from the "id" field of the table's hash, in ranges sized as
+  those of AUTO_INCREMENT values (see get_auto_increment()); ids not used
+  leave empty fields, which scans step over.
+*/
+int ha_redis::next_row_id(ulonglong *id) {
+    DBUG_ENTER("ha_redis::next_row_id");
+    Redis_auto_inc &ri = share->row_ids;
+    std::unique_lock<std::mutex> guard(ri.mutex);
+
+    if (ri.last == 0 || ri.next > ri.last) {
+        ulonglong now = my_micro_time();
+        if (ri.last && now - ri.reserved_at < REDIS_AUTO_INC_FAST) {
+            ri.range = std::min<ulonglong>(ri.range * 2, REDIS_AUTO_INC_MAX_RANGE);
+        } else if (ri.last && now - ri.reserved_at > REDIS_AUTO_INC_SLOW) {
+            ri.range = std::max<ulonglong>(ri.range / 2, 1);
+        }
+        ulonglong n = ri.range;
+        guard.unlock();
+
+        redisReply *rr = redis_call(primary, {"HINCRBY", share->table_name, "id",
+                                              std::to_string(n)}, false);
+        if (!rr || rr->type != REDIS_REPLY_INTEGER) {
+            if (rr) {
+                freeReplyObject(rr);
+            }
+            DBUG_RETURN(rr ? HA_ERR_INTERNAL_ERROR : HA_ERR_NO_CONNECTION);
+        }
+        ulonglong last = rr->integer;
+        freeReplyObject(rr);
+
+        guard.lock();
+        if (last <= ri.last) {
+            // another handler reserved a newer range meanwhile, keep it
+            *id = last - n + 1;
+            DBUG_RETURN(0);
+        }
+        ri.last = last;
+        ri.next = last - n + 1;
+        ri.reserved_at = now;
+    }
+    *id = ri.next++;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Account for the AUTO_INCREMENT value of an inserted or updated row. Values
+  handed out by get_auto_increment() are known already; an explicit value
+  beyond the reserved range must raise the counter, which the write script
+  does.
+
+  @return true if the insert must raise the counter to value.
+*/
+bool ha_redis::note_auto_increment(ulonglong value) {
+    Redis_auto_inc &ai = share->auto_inc;
+    std::lock_guard<std::mutex> guard(ai.mutex);
+
+    if (value >= ai.next) {
+        // values up to an explicit one are not handed out anymore
+        ai.next = value + 1;
+    }
+    if (value <= ai.last) {
+        return false;
+    }
+    ai.floor = std::max(ai.floor, value);
+    return true;
+}
+
+/**
+  @brief
+  write_row() inserts a row. No extra() hint is given currently if a bulk load
+  is happening. buf() is a byte array of data. You can use the field
+  information to extract the data from the native byte array type.
+
+  @details
+  Redis of this would be:
+  @code
+  for (Field **field=table->field ; *field ; field++)
+  {
+    ...
+  }
+  @endcode
+
+  See ha_tina.cc for an example of extracting all of the data as strings.
+*/
+int ha_redis::write_row(uchar *buf) {
+    DBUG_ENTER("ha_redis::write_row");
+    std::string record_str;
+
+    ha_statistic_increment(&System_status_var::ha_write_count);
+    std::string auto_inc_str;
+    if (table->next_number_field && buf == table->record[0]) {
+        int rc = update_auto_increment();
+        if (rc) {
+            DBUG_RETURN(rc);
+        }
+        longlong value = table->next_number_field->val_int();
+        if (value > 0 && note_auto_increment((ulonglong)value)) {
+            auto_inc_str = std::to_string(value);
+        }
+    }
+    Redis_blob_writes blobs(blob_limit());
+    pack_row(&record_str, &blobs);
+    std::string key_str;
+    bool null_key = false;
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        // without an index, Redis stamps the entry with the current time
+        if (table->s->keys > 0) {
+            key_str = std::to_string(stream_key(buf));
+        }
+    } else if (!share->index_name.empty()) {
+        null_key = pack_key(buf, &key_str);
+    }
+    // REPLACE overwrites the row holding the key in the same call, unless
+    // the values of the row it replaces may have to be deleted. A key with
+    // a NULL part can't be held by another row.
+    bool replace = write_can_replace && !share->index_name.empty() && !null_key &&
+                   table->s->blob_fields == 0;
+    redis_script_id script = layout_script(replace ? REDIS_SCRIPT_REPLACE
+                                                   : REDIS_SCRIPT_INSERT);
+    bool buckets = (share->layout == REDIS_LAYOUT_BUCKETS);
+    ulonglong held = 0;
+
+    if (share->layout != REDIS_LAYOUT_STREAM && !key_str.empty()) {
+        // the commit checks again, but report what we can now
+        bool check = trx && !replace;
+        // a buffered or queued write can't ask for the bucket of the row
+        // holding the key when it runs (see REDIS_SCRIPT_BUCKET_INSERT),
+        // and later reads of the transaction need the position of the row
+        bool look = (buckets && (trx || write_behind) && (replace || share->expires())) ||
+                    (trx && replace);
+        if (check || look) {
+            int rc = key_holder(key_str, &held);
+            if (rc) {
+                DBUG_RETURN(rc);
+            }
+            if (check && held) {
+                dup_position = held;
+                DBUG_RETURN(HA_ERR_FOUND_DUPP_KEY);
+            }
+        }
+        if (replace && (held & REDIS_TRX_POSITION)) {
+            // the transaction inserted the row it replaces
+            current_position = held;
+            rewrite_own_insert(record_str, key_str, auto_inc_str, blobs.set);
+            stats.records++;
+            DBUG_RETURN(0);
+        }
+    }
+
+    Redis_args argv = {record_str, key_str, auto_inc_str};
+    ulonglong row_id = 0;
+    if (buckets) {
+        int rc = next_row_id(&row_id);
+        if (rc) {
+            DBUG_RETURN(rc);
+        }
+        argv.push_back(std::to_string(row_id));
+        argv.push_back(held ? std::to_string(held) : "");
+    }
+    argv.insert(argv.end(), blobs.set.begin(), blobs.set.end());
+    if (write_behind) {
+        queue_behind(redis_evalsha_args(script, write_keys(row_id, held), argv), 1);
+        behind_queued = true;
+        stats.records++;
+        DBUG_RETURN(0);
+    }
+    int rc;
+    if (share->layout == REDIS_LAYOUT_STREAM && !trx) {
+        rc = stream_append(argv);
+    } else {
+        // a replace writes the row holding the key, if one did when looked
+        ulonglong position = (replace && held) ? held : row_id;
+        rc = run_write(script, write_keys(row_id, held), argv, position, buckets ? 4 : 0);
+        if (rc == HA_ERR_RECORD_CHANGED && buckets && !trx) {
+            // the id was taken: the table's hash went away with its rows
+            // and was created again after this server reserved the id
+            {
+                std::lock_guard<std::mutex> guard(share->row_ids.mutex);
+                share->row_ids.last = 0;
+            }
+            rc = next_row_id(&row_id);
+            if (!rc) {
+                argv[3] = std::to_string(row_id);
+                rc = run_write(script, write_keys(row_id, held), argv, row_id, 4);
+            }
+        }
+    }
+    if (rc) {
+        DBUG_RETURN(rc);
+    }
+
+    stats.records++;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  The row holding an index key, 0 if none does: in Redis, or as the
+  buffered writes of the transaction leave it.
+*/
+int ha_redis::key_holder(const std::string &key, ulonglong *held) {
+    DBUG_ENTER("ha_redis::key_holder");
+    Redis_trx::Row own;
+    if (trx && trx->find_key(share->table_name, key, &own)) {
+        *held = own.row ? own.position : 0;
+        DBUG_RETURN(0);
+    }
+    redisReply *rr = redis_call(c, {"HGET", share->index_name, key}, true);
+    if (!rr) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    *held = (rr->type == REDIS_REPLY_STRING) ? strtoull(rr->str, NULL, 10) : 0;
+    freeReplyObject(rr);
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Yes, update_row() does what you expect, it updates a row. old_data will have
+  the previous row record in it, while new_data will have the newest data in it.
+  Keep in mind that the server can do updates based on ordering if an ORDER BY
+  clause was used. Consecutive ordering is not guaranteed.
+
+  @details
+  The row is replaced only if it is still the one read by rnd_next(),
+  rnd_pos() or index_read_map(), compared and set in one script call which
+  also moves the index entry if the key changes. Out-of-line values of
+  columns which aren't updated are kept, replaced ones are deleted.
+  The entries of a stream can't be changed.
+*/
+int ha_redis::update_row(const uchar *old_data, uchar *new_data) {
+    DBUG_ENTER("ha_redis::update_row");
+    ha_statistic_increment(&System_status_var::ha_update_count);
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+    std::string record_str;
+    Redis_blob_writes blobs(blob_limit(), &current_row, table->write_set);
+    pack_row(&record_str, &blobs);
+
+    std::string old_key, new_key;
+    if (!share->index_name.empty()) {
+        pack_key(old_data, &old_key);
+        pack_key(new_data, &new_key);
+    }
+    // a value set by the update is explicit too, see note_auto_increment()
+    std::string auto_inc_str;
+    Field *auto_inc_field = table->found_next_number_field;
+    if (auto_inc_field && bitmap_is_set(table->write_set, auto_inc_field->field_index)) {
+        ptrdiff_t offset = new_data - table->record[0];
+        auto_inc_field->move_field_offset(offset);
+        longlong value = auto_inc_field->val_int();
+        auto_inc_field->move_field_offset(-offset);
+        if (value > 0 && note_auto_increment((ulonglong)value)) {
+            auto_inc_str = std::to_string(value);
+        }
+    }
+    if (current_position & REDIS_TRX_POSITION) {
+        // the transaction inserted the row, which has no position yet
+        rewrite_own_insert(record_str, new_key, auto_inc_str, blobs.set);
+        previous_row.swap(current_row);
+        current_row.swap(record_str);
+        DBUG_RETURN(0);
+    }
+    Redis_args argv = {std::to_string(current_position), current_row, record_str,
+                       old_key, new_key, std::to_string(blobs.set.size() / 2), auto_inc_str};
+    bool buckets = (share->layout == REDIS_LAYOUT_BUCKETS);
+    ulonglong held = 0;
+    if (buckets) {
+        // a buffered update can't ask for the bucket of the row holding the
+        // new key when it runs (see REDIS_SCRIPT_BUCKET_UPDATE)
+        if (trx && share->expires() && !new_key.empty() && new_key != old_key) {
+            int rc = key_holder(new_key, &held);
+            if (rc) {
+                DBUG_RETURN(rc);
+            }
+        }
+        argv.push_back(held ? std::to_string(held) : "");
+    }
+    argv.insert(argv.end(), blobs.set.begin(), blobs.set.end());
+    argv.insert(argv.end(), blobs.del.begin(), blobs.del.end());
+
+    int rc = run_write(layout_script(REDIS_SCRIPT_UPDATE), write_keys(current_position, held),
+                       argv, current_position, buckets ? 7 : 0);
+    if (rc == 0) {
+        // old_data may point into the old image (BLOBs), keep it until the next update
+        previous_row.swap(current_row);
+        current_row.swap(record_str);
+    }
+
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  This will delete a row.
+  This set the value "." if the row was not changed since it was read.
+  And After setting all deleting rows Actually delete them in rnd_end().
+*/
+int ha_redis::delete_row(const uchar *buf) {
+    DBUG_ENTER("ha_redis::delete_row");
+    ha_statistic_increment(&System_status_var::ha_delete_count);
+
+    if (current_position & REDIS_TRX_POSITION) {
+        // the transaction inserted the row: it won't be
+        trx->supersede(current_position, false);
+        DBUG_RETURN(0);
+    }
+    std::string key_str;
+    if (!share->index_name.empty()) {
+        pack_key(buf, &key_str);
+    }
+    std::string position = (share->layout == REDIS_LAYOUT_STREAM)
+                               ? current_id : std::to_string(current_position);
+    Redis_args argv = {position, current_row, key_str};
+    share->codec.blob_ids(current_row.data(), current_row.length(), NULL, &argv);
+
+    DBUG_RETURN(run_write(layout_script(REDIS_SCRIPT_DELETE), write_keys(current_position, 0),
+                          argv, share->layout == REDIS_LAYOUT_STREAM ? 0 : current_position));
+}
+
+/**
+  @brief
+  Remember when the session last wrote, so that its reads go to replicas
+  which have caught up with the write (see redis_pick_replica()).
+*/
+static void redis_note_write(THD *thd) {
+    if (redis_replica_count() > 0) {
+        Redis_trx *t = get_trx(thd, true);
+        if (t) {
+            t->read_point.last_write = my_micro_time();
+        }
+    }
+}
+
+/**
+  @brief
+  Run a write script on this table, or buffer it when the statement is
+  transactional (see Redis_trx).
+
+  @param position  position of the row written, 0 if only the script
+                   decides it (see Redis_trx::add())
+  @param held_arg  index in argv of the row which held the index key, for
+                   a bucket script which answers {row id} when another row
+                   holds it: it runs again with that row and its bucket
+
+  @see redis_script_id for the values the write scripts return.
+*/
+int ha_redis::run_write(redis_script_id script, Redis_args keys, Redis_args argv,
+                        ulonglong position, size_t held_arg) {
+    DBUG_ENTER("ha_redis::run_write");
+
+    if (trx) {
+        trx->add(script, keys, argv, position);
+        DBUG_RETURN(0);
+    }
+
+    redisReply *ret = redis_eval(c, script, keys, argv);
+    for (int attempt = 1; ret && held_arg && ret->type == REDIS_REPLY_ARRAY &&
+                          ret->elements == 1 && attempt < REDIS_TRX_ATTEMPTS; attempt++) {
+        ulonglong held = ret->element[0]->integer;
+        freeReplyObject(ret);
+        argv[held_arg] = std::to_string(held);
+        keys.back() = redis_bucket_name(share->table_name, held / REDIS_BUCKET_ROWS);
+        ret = redis_eval(c, script, keys, argv);
+    }
+    if (!ret) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    int rc = 0;
+    redis_note_write(ha_thd());
+    if (held_arg && ret->type == REDIS_REPLY_ARRAY) {
+        // the key kept moving to other rows
+        redis_status.conflicts++;
+        rc = HA_ERR_RECORD_CHANGED;
+    } else if (ret->type != REDIS_REPLY_INTEGER) {
+        rc = HA_ERR_INTERNAL_ERROR;
+    } else if (ret->integer < 0) {
+        dup_position = -ret->integer;
+        rc = HA_ERR_FOUND_DUPP_KEY;
+    } else if (ret->integer == 0) {
+        redis_status.conflicts++;
+        rc = HA_ERR_RECORD_CHANGED;
+    }
+    freeReplyObject(ret);
+
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Insert a row into a stream table. During a bulk insert the rows are
+  collected and sent by stream_flush() REDIS_STREAM_BATCH at a time; a
+  single insert is flushed right away.
+*/
+int ha_redis::stream_append(const Redis_args &argv) {
+    DBUG_ENTER("ha_redis::stream_append");
+    stream_pending.insert(stream_pending.end(), argv.begin(), argv.end());
+    if (bulk_insert && stream_pending.size() < 3 * REDIS_STREAM_BATCH) {
+        DBUG_RETURN(0);
+    }
+    DBUG_RETURN(stream_flush());
+}
+
+/**
+  @brief
+  Append the rows collected by stream_append() in one call of
+  REDIS_SCRIPT_STREAM_INSERT. The stream is trimmed to its retention in
+  the same round trip. A call which found its script missing (Redis was
+  restarted meanwhile) is sent again.
+
+  @return HA_ERR_REDIS_STREAM_ORDER if the key of a row is lower than the
+          one of the last entry: that row and the ones after it aren't
+          appended.
+*/
+int ha_redis::stream_flush() {
+    DBUG_ENTER("ha_redis::stream_flush");
+    if (stream_pending.empty()) {
+        DBUG_RETURN(0);
+    }
+
+    Redis_args insert = redis_evalsha_args(REDIS_SCRIPT_STREAM_INSERT, row_keys(),
+                                           stream_pending);
+    std::vector<Redis_args> trim;
+    stream_trim_args(&trim);
+    redis_append_args(c, insert);
+    for (const Redis_args &args : trim) {
+        redis_append_args(c, args);
+    }
+
+    redisReply *inserted = NULL;
+    for (size_t i = 0; i < 1 + trim.size(); i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(c, (void **)&reply) != REDIS_OK) {
+            redis_reconnect(c);
+            if (inserted) {
+                freeReplyObject(inserted);
+            }
+            stream_pending.clear();
+            DBUG_RETURN(HA_ERR_NO_CONNECTION);
+        }
+        // a failed XTRIM (e.g. MINID before Redis 6.2) doesn't fail the inserts
+        if (i == 0) {
+            inserted = reply;
+        } else {
+            freeReplyObject(reply);
+        }
+    }
+    if (redis_is_noscript(inserted)) {
+        freeReplyObject(inserted);
+        inserted = redis_eval(c, REDIS_SCRIPT_STREAM_INSERT, row_keys(), stream_pending);
+        if (!inserted) {
+            stream_pending.clear();
+            DBUG_RETURN(HA_ERR_NO_CONNECTION);
+        }
+    }
+
+    int rc = 0;
+    if (inserted->type != REDIS_REPLY_INTEGER) {
+        rc = HA_ERR_INTERNAL_ERROR;
+    } else if ((size_t)inserted->integer < stream_pending.size() / 3) {
+        rc = HA_ERR_REDIS_STREAM_ORDER;
+    }
+    freeReplyObject(inserted);
+    stream_pending.clear();
+    redis_note_write(ha_thd());
+
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  XTRIM commands applying the retention of a stream table: keep
+  redis_stream_maxlen entries and the entries of the last
+  redis_stream_retention seconds. The trimming is approximate ("~"): Redis
+  only drops whole nodes of the stream, so a few more entries may stay.
+
+  @details
+  The entry IDs of a table without index start with the insert time in
+  milliseconds. Those of a table ordered by a TIMESTAMP column start with
+  its sort key: the seconds, big-endian, followed by the fraction bytes.
+*/
+void ha_redis::stream_trim_args(std::vector<Redis_args> *commands) {
+    if (share->stream_maxlen > 0) {
+        commands->push_back({"XTRIM", share->table_name, "MAXLEN", "~",
+                             std::to_string(share->stream_maxlen)});
+    }
+    if (share->stream_retention > 0) {
+        ulonglong now = my_micro_time() / 1000000;
+        ulonglong oldest = now > share->stream_retention ? now - share->stream_retention : 0;
+        ulonglong key;
+        if (table->s->keys == 0) {
+            key = oldest * 1000;
+        } else {
+            size_t fraction = table->key_info->key_part[0].field->sort_length() - 4;
+            key = oldest << (8 * fraction);
+        }
+        commands->push_back({"XTRIM", share->table_name, "MINID", "~",
+                             redis_stream_id(key, 0)});
+    }
+}
+
+/**
+  @brief
+  Run a read-only script for a point read. On a replica the read is hedged:
+  if it isn't answered within the redis_hedge_percentile latency of point
+  reads, it goes to the primary as well and the first answer is used.
+*/
+redisReply *ha_redis::point_read(redis_script_id script, const Redis_args &keys,
+                                 const Redis_args &argv) {
+    DBUG_ENTER("ha_redis::point_read");
+    ulonglong start = my_micro_time();
+    ulonglong delay = hedge ? redis_latency_percentile(srv_hedge_percentile) : 0;
+    bool alt_won = false;
+
+    redisReply *reply = delay ? redis_eval_hedged(c, hedge, script, keys, argv, delay,
+                                                  &alt_won)
+                              : redis_eval(c, script, keys, argv);
+    if (reply) {
+        redis_record_latency(my_micro_time() - start);
+    }
+    current_hedged = alt_won;
+    DBUG_RETURN(reply);
+}
+
+/**
+  @brief
+  Positions an index cursor to the index specified in the handle. Fetches the
+  row if available. If the key value is null, begin at the first key of the
+  index.
+
+  @details
+  The index is unique and hashed, so only exact lookups of a whole key are
+  supported. The index hash and the row are read by one script call; in a
+  bucket table the first call finds the row id, which tells the bucket the
+  second one reads the row from.
+  The index of a stream table is read as a range of entry IDs by
+  XRANGE/XREVRANGE (see stream_seek()).
+*/
+int ha_redis::index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map,
+                             enum ha_rkey_function find_flag) {
+    DBUG_ENTER("ha_redis::index_read_map");
+    ha_statistic_increment(&System_status_var::ha_read_key_count);
+
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        KEY *key_info = table->key_info + active_index;
+        key_restore(buf, key, key_info, calculate_key_len(table, active_index, keypart_map));
+        ulonglong k = stream_key(buf);
+        std::string from;
+        bool reverse = false;
+
+        switch (find_flag) {
+            case HA_READ_KEY_EXACT:
+            case HA_READ_KEY_OR_NEXT:
+                from = redis_stream_id(k, 0);
+                break;
+            case HA_READ_AFTER_KEY:
+                from = redis_stream_next_id(redis_stream_id(k, ULLONG_MAX));
+                break;
+            case HA_READ_KEY_OR_PREV:
+            case HA_READ_PREFIX_LAST:
+            case HA_READ_PREFIX_LAST_OR_PREV:
+                from = redis_stream_id(k, ULLONG_MAX);
+                reverse = true;
+                break;
+            case HA_READ_BEFORE_KEY:
+                from = redis_stream_prev_id(redis_stream_id(k, 0));
+                reverse = true;
+                break;
+            default:
+                DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+        }
+        stream_key_read = k;
+        int rc = stream_seek(buf, from, reverse);
+        if (rc == HA_ERR_END_OF_FILE) {
+            rc = HA_ERR_KEY_NOT_FOUND;
+        }
+        ulonglong found, seq;
+        redis_stream_parse_id(current_id, &found, &seq);
+        if (rc == 0 && found != k &&
+            (find_flag == HA_READ_KEY_EXACT || find_flag == HA_READ_PREFIX_LAST)) {
+            rc = HA_ERR_KEY_NOT_FOUND;
+        }
+        DBUG_RETURN(rc);
+    }
+
+    if (find_flag != HA_READ_KEY_EXACT) {
+        DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+
+    // sort keys are built from fields, so put the key values into buf first
+    KEY *key_info = table->key_info + active_index;
+    key_restore(buf, key, key_info, calculate_key_len(table, active_index, keypart_map));
+    std::string key_str;
+    null_lookup = pack_key(buf, &key_str);
+    if (null_lookup) {
+        // the rows with NULL in the key aren't in the index: scan for them
+        int rc = check_own_writes();
+        if (rc) {
+            DBUG_RETURN(rc);
+        }
+        pack_key(buf, &null_key, true);
+        free_scan_reply();
+        scan_position = 0;
+        rc = next_null_key(buf);
+        DBUG_RETURN(rc == HA_ERR_END_OF_FILE ? HA_ERR_KEY_NOT_FOUND : rc);
+    }
+    Redis_trx::Row own;
+    if (trx && trx->find_key(share->table_name, key_str, &own)) {
+        DBUG_RETURN(read_own_row(buf, own));
+    }
+
+    redisReply *rr = point_read(layout_script(REDIS_SCRIPT_LOOKUP), row_keys(), {key_str});
+    for (int attempt = 0; rr && share->layout == REDIS_LAYOUT_BUCKETS &&
+                          rr->type == REDIS_REPLY_ARRAY && rr->elements == 1;
+         attempt++) {
+        // the key is at this row: read it from its bucket
+        ulonglong id = rr->element[0]->integer;
+        freeReplyObject(rr);
+        if (attempt == REDIS_TRX_ATTEMPTS) {
+            DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);  // the key kept moving to other rows
+        }
+        rr = point_read(REDIS_SCRIPT_BUCKET_LOOKUP, write_keys(id, 0),
+                        {key_str, std::to_string(id)});
+    }
+    if (!rr) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (rr->type != REDIS_REPLY_ARRAY) {
+        freeReplyObject(rr);
+        DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
+    if (rr->elements < 2) {
+        freeReplyObject(rr);
+        DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
+    }
+    current_position = rr->element[0]->integer;
+    current_row.assign(rr->element[1]->str, rr->element[1]->len);
+    freeReplyObject(rr);
+    if (row_expired(current_row.data(), current_row.length())) {
+        DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
+    }
+
+    row_arena.reset();
+    int rc = fetch_blobs(current_hedged ? hedge : c, &row_arena, current_row.data(),
+                         current_row.length(), &row_blobs);
+    if (rc) {
+        DBUG_RETURN(rc);
+    }
+    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
+    rc = unpack_row(buf, current_row.data(), current_row.length(), &row_blobs);
+    tmp_restore_column_map(table->write_set, org_bitmap);
+
+    DBUG_RETURN(rc);
+}
+
+int ha_redis::index_init(uint idx, bool) {
+    DBUG_ENTER("ha_redis::index_init");
+    active_index = idx;
+    // reads of a stream's index are range reads, which can't see the
+    // buffered writes; point reads of the other layouts can
+    DBUG_RETURN(share->layout == REDIS_LAYOUT_STREAM ? check_own_writes() : 0);
+}
+
+/**
+  @brief
+  Deleted rows of list tables stay as tombstones, so that the positions
+  stored in the index don't move. Inserts take their place (see FREE_SLOTS
+  in redis_scripts.cc), OPTIMIZE TABLE removes them.
+*/
+int ha_redis::index_end() {
+    DBUG_ENTER("ha_redis::index_end");
+    if (null_lookup) {
+        free_scan_reply();
+        null_lookup = false;
+    }
+    active_index = MAX_KEY;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Start reading a stream table at the entry ID from (empty: there is none)
+  and read the first row. A forward read ends with the range being read
+  (see handler::read_range_first()), so that a time range costs about as
+  many entries as it holds; a backward read ends with the stream, the
+  server checks the lower bound.
+*/
+int ha_redis::stream_seek(uchar *buf, const std::string &from, bool reverse) {
+    DBUG_ENTER("ha_redis::stream_seek");
+    free_scan_reply();
+    stream_from = from;
+    stream_reverse = reverse;
+    stream_to = reverse ? "-" : "+";
+    if (!reverse && end_range && end_range->keypart_map) {
+        // the key is restored into record[1] to get the field's sort key
+        key_restore(table->record[1], end_range->key, table->key_info + active_index,
+                    end_range->length);
+        stream_to = redis_stream_id(stream_key(table->record[1]), ULLONG_MAX);
+    }
+    DBUG_RETURN(read_next(buf));
+}
+
+/**
+  @brief
+  Used to read forward through the index.
+*/
+int ha_redis::index_next(uchar *buf) {
+    DBUG_ENTER("ha_redis::index_next");
+    if (share->layout != REDIS_LAYOUT_STREAM) {
+        DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+    ha_statistic_increment(&System_status_var::ha_read_next_count);
+    if (stream_reverse) {
+        DBUG_RETURN(stream_seek(buf, redis_stream_next_id(current_id), false));
+    }
+    DBUG_RETURN(read_next(buf));
+}
+
+/**
+  @brief
+  The index is unique, so no other row has the same key. In a stream,
+  the rows with the same key follow each other.
+*/
+int ha_redis::index_next_same(uchar *buf, const uchar *, uint) {
+    DBUG_ENTER("ha_redis::index_next_same");
+    if (share->layout != REDIS_LAYOUT_STREAM) {
+        // a whole key other than a NULL one matches one row at most
+        DBUG_RETURN(null_lookup ? next_null_key(buf) : HA_ERR_END_OF_FILE);
+    }
+    int rc = index_next(buf);
+    ulonglong key, seq;
+    redis_stream_parse_id(current_id, &key, &seq);
+    if (rc == 0 && key != stream_key_read) {
+        rc = HA_ERR_END_OF_FILE;
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Used to read backwards through the index.
+*/
+int ha_redis::index_prev(uchar *buf) {
+    DBUG_ENTER("ha_redis::index_prev");
+    if (share->layout != REDIS_LAYOUT_STREAM) {
+        DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+    ha_statistic_increment(&System_status_var::ha_read_prev_count);
+    if (!stream_reverse) {
+        DBUG_RETURN(stream_seek(buf, redis_stream_prev_id(current_id), true));
+    }
+    DBUG_RETURN(read_next(buf));
+}
+
+/**
+  @brief
+  index_first() asks for the first key in the index.
+*/
+int ha_redis::index_first(uchar *buf) {
+    DBUG_ENTER("ha_redis::index_first");
+    if (share->layout != REDIS_LAYOUT_STREAM) {
+        DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+    ha_statistic_increment(&System_status_var::ha_read_first_count);
+    DBUG_RETURN(stream_seek(buf, "-", false));
+}
+
+/**
+  @brief
+  index_last() asks for the last key in the index.
+*/
+int ha_redis::index_last(uchar *buf) {
+    DBUG_ENTER("ha_redis::index_last");
+    if (share->layout != REDIS_LAYOUT_STREAM) {
+        DBUG_RETURN(HA_ERR_WRONG_COMMAND);
+    }
+    ha_statistic_increment(&System_status_var::ha_read_last_count);
+    DBUG_RETURN(stream_seek(buf, "+", true));
+}
+
+/**
+  @brief
+  rnd_init() is called when the system wants the storage engine to do a table
+  scan.
+*/
+int ha_redis::rnd_init(bool) {
+    DBUG_ENTER("ha_redis::rnd_init");
+    int rc = check_own_writes();
+    if (rc) {
+        DBUG_RETURN(rc);
+    }
+
+    free_scan_reply();
+    current_position = 0;
+    scan_position = 0;
+    stream_from = "-";
+    stream_to = "+";
+    stream_reverse = false;
+    stats.records = 0;
+    counted = 0;
+    count_from.clear();
+    if (counted_cond) {
+        count_from = (share->layout == REDIS_LAYOUT_STREAM) ? "-" : "0";
+    }
+
+    DBUG_RETURN(0);
+}
+
+int ha_redis::rnd_end() {
+    DBUG_ENTER("ha_redis::rnd_end");
+
+    free_scan_reply();
+    current_position = 0;
+    DBUG_RETURN(0);
+}
+
+void ha_redis::free_scan_reply() {
+    // the reply lives in scan_arena, whose blocks are kept for the next batch
+    scan_reply = NULL;
+    scan_arena.reset();
+    scan_element = 0;
+    scan_blobs.reset(NULL);
+}
+
+/**
+  @brief
+  Fetch the next batch of rows of a table scan into scan_reply.
+  Bounds check, range read, tombstone skipping, the pushed condition (see
+  cond_push()) and, on the primary, the reclaim of expired rows (see
+  reclaims()) are done by one script,
+  the out-of-line values the statement reads by one HMGET for the batch.
+*/
+int ha_redis::fetch_rows() {
+    DBUG_ENTER("ha_redis::fetch_rows");
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        DBUG_RETURN(fetch_stream_rows());
+    }
+
+    free_scan_reply();
+    ulong batch = THDVAR(ha_thd(), scan_batch_size);
+    Redis_args keys = chunk_keys(scan_position, batch);
+    Redis_args argv = {std::to_string(scan_position), std::to_string(batch), ""};
+    if (reclaims()) {
+        keys = row_keys();
+        argv[2] = "reclaim";
+    }
+    argv.insert(argv.end(), pushed.begin(), pushed.end());
+    scan_reply = redis_eval_arena(c, &scan_arena, layout_script(REDIS_SCRIPT_FETCH), keys, argv);
+    if (!scan_reply) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (scan_reply->type != REDIS_REPLY_ARRAY || scan_reply->elements < 1) {
+        free_scan_reply();
+        DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
+
+    unsigned long next_position = scan_reply->element[0]->integer;
+    if (next_position == scan_position) {
+        free_scan_reply();
+        DBUG_RETURN(HA_ERR_END_OF_FILE);
+    }
+    scan_position = next_position;
+    scan_element = 1;
+    int rc = fetch_blobs(c, &scan_arena, NULL, 0, &scan_blobs);
+    if (rc) {
+        free_scan_reply();
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Fetch the next batch of entries of a stream table from stream_from. The
+  batch after it starts right after its last entry, unless the batch
+  wasn't full.
+*/
+int ha_redis::fetch_stream_rows() {
+    DBUG_ENTER("ha_redis::fetch_stream_rows");
+
+    free_scan_reply();
+    if (stream_from.empty()) {
+        DBUG_RETURN(HA_ERR_END_OF_FILE);
+    }
+    ulong batch = THDVAR(ha_thd(), scan_batch_size);
+    Redis_args argv = {stream_from, stream_to, std::to_string(batch), stream_reverse ? "rev" : ""};
+    argv.insert(argv.end(), pushed.begin(), pushed.end());
+    scan_reply = redis_eval_arena(c, &scan_arena, REDIS_SCRIPT_STREAM_FETCH,
+                                  {share->table_name}, argv);
+    if (!scan_reply) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (scan_reply->type != REDIS_REPLY_ARRAY || scan_reply->elements < 2) {
+        free_scan_reply();
+        DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
+
+    ulonglong entries = scan_reply->element[0]->integer;
+    if (entries == 0) {
+        free_scan_reply();
+        stream_from.clear();
+        DBUG_RETURN(HA_ERR_END_OF_FILE);
+    }
+    if (entries < batch) {
+        stream_from.clear();
+    } else {
+        // the last entry read, which the condition may have left out
+        const redisReply *last = scan_reply->element[1];
+        std::string id(last->str, last->len);
+        stream_from = stream_reverse ? redis_stream_prev_id(id) : redis_stream_next_id(id);
+    }
+    scan_element = 2;
+    int rc = fetch_blobs(c, &scan_arena, NULL, 0, &scan_blobs);
+    if (rc) {
+        free_scan_reply();
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  This is called for each row of the table scan. When you run out of records
+  you should return HA_ERR_END_OF_FILE. Fill buff up with the row information.
+  The Field structure for the table is the key to getting data into buf
+  in a manner that will allow the server to understand it.
+*/
+int ha_redis::rnd_next(uchar *buf) {
+    DBUG_ENTER("ha_redis::rnd_next");
+    ha_statistic_increment(&System_status_var::ha_read_rnd_next_count);
+
+    int rc = counted_cond ? count_next(buf) : read_next(buf);
+    if (rc == 0) {
+        stats.records++;
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Count the rows of the next chunk which pass the pushed condition inside
+  Redis, for a scan which only counts (see cond_push()). The rows the
+  script can't tell about come along, for count_next() to check.
+*/
+int ha_redis::fetch_counts() {
+    DBUG_ENTER("ha_redis::fetch_counts");
+    free_scan_reply();
+    Redis_args keys = (share->layout == REDIS_LAYOUT_BUCKETS)
+                          ? chunk_keys(strtoull(count_from.c_str(), NULL, 10), REDIS_COUNT_CHUNK)
+                          : row_keys();
+    Redis_args argv = {count_from, std::to_string(REDIS_COUNT_CHUNK),
+                       share->expires() ? "expiry" : "", "", reclaims() ? "reclaim" : ""};
+    argv.insert(argv.end(), pushed.begin(), pushed.end());
+    scan_reply = redis_eval_arena(c, &scan_arena, layout_script(REDIS_SCRIPT_COUNT), keys, argv);
+    if (!scan_reply) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (scan_reply->type != REDIS_REPLY_ARRAY || scan_reply->elements < 2 ||
+        scan_reply->element[0]->type != REDIS_REPLY_INTEGER) {
+        free_scan_reply();
+        DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
+    counted = scan_reply->element[0]->integer;
+    const redisReply *next = scan_reply->element[1];
+    count_from = (next->type == REDIS_REPLY_INTEGER) ? std::to_string(next->integer)
+                                                      : std::string(next->str, next->len);
+    scan_element = 2;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  rnd_next() of a scan which only counts: return as many rows as the count
+  scripts found passing the pushed condition, without reading them, then
+  those of the rows they couldn't tell about which pass it.
+*/
+int ha_redis::count_next(uchar *buf) {
+    DBUG_ENTER("ha_redis::count_next");
+    for (;;) {
+        if (counted > 0) {
+            counted--;
+            DBUG_RETURN(0);
+        }
+        while (scan_reply && scan_element < scan_reply->elements) {
+            const redisReply *row = scan_reply->element[scan_element + 1];
+            scan_element += 2;
+            my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
+            int rc = unpack_row(buf, row->str, row->len, &scan_blobs);
+            tmp_restore_column_map(table->write_set, org_bitmap);
+            if (rc) {
+                DBUG_RETURN(rc);
+            }
+            // buf is record[0], which the condition reads
+            if (const_cast<Item *>(counted_cond)->val_int()) {
+                DBUG_RETURN(0);
+            }
+        }
+        if (count_from.empty()) {
+            free_scan_reply();
+            DBUG_RETURN(HA_ERR_END_OF_FILE);
+        }
+        int rc = fetch_counts();
+        if (rc) {
+            DBUG_RETURN(rc);
+        }
+    }
+}
+
+/**
+  @brief
+  Return the next row of the scan started by index_read_map() for a key
+  with a NULL part whose key is null_key.
+*/
+int ha_redis::next_null_key(uchar *buf) {
+    DBUG_ENTER("ha_redis::next_null_key");
+    std::string key_str;
+    int rc;
+    while ((rc = read_next(buf)) == 0) {
+        pack_key(buf, &key_str, true);
+        if (key_str == null_key) {
+            break;
+        }
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Return the next row of the batches of the current scan, or of the index
+  read of a stream table.
+*/
+int ha_redis::read_next(uchar *buf) {
+    DBUG_ENTER("ha_redis::read_next");
+
+    const redisReply *pos;
+    const redisReply *row;
+    do {
+        // a batch may consist of tombstones only, then fetch the next one
+        while (!scan_reply || scan_element >= scan_reply->elements) {
+            int rc = fetch_rows();
+            if (rc) {
+                DBUG_RETURN(rc);
+            }
+        }
+        pos = scan_reply->element[scan_element];
+        row = scan_reply->element[scan_element + 1];
+        scan_element += 2;
+        // expired rows have no out-of-line values, skipping them keeps scan_blobs in step
+    } while (share->expires() && row_expired(row->str, row->len));
+
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        current_id.assign(pos->str, pos->len);
+    } else {
+        current_position = pos->integer;
+    }
+    current_hedged = false;
+    current_row.assign(row->str, row->len);
+
+    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
+    int rc = unpack_row(buf, current_row.data(), current_row.length(), &scan_blobs);
+    tmp_restore_column_map(table->write_set, org_bitmap);
+
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  position() is called after each call to rnd_next() if the data needs
+  to be ordered. You can do something like the following to store
+  the position:
+  @code
+  my_store_ptr(ref, ref_length, current_position);
+  @endcode
+
+  @details
+  The server uses ref to store data. ref_length in the above case is
+  the size needed to store current_position. ref is just a byte array
+  that the server will maintain. If you are using offsets to mark rows, then
+  current_position should be the offset. If it is a primary key like in
+  BDB, then it needs to be a primary key.
+
+  @details
+  The lowest bit tells whether the row was read from the hedge endpoint:
+  positions on two servers can differ while a replica lags behind a
+  compaction, so rnd_pos() must go back to the server the row came from.
+  A row of a stream table is referred to by its entry ID, as two 8 byte
+  numbers, the bit being the lowest of the second.
+*/
+void ha_redis::position(const uchar *) {
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        ulonglong key, seq;
+        redis_stream_parse_id(current_id, &key, &seq);
+        int8store(ref, key);
+        int8store(ref + sizeof(ulonglong), (seq << 1) | current_hedged);
+        return;
+    }
+    my_store_ptr(ref, ref_length, (current_position << 1) | current_hedged);
+}
+
+/**
+  @brief
+  This is like rnd_next, but you are given a position to use
+  to determine the row. The position will be of the type that you stored in
+  ref. You can use ha_get_ptr(pos,ref_length) to retrieve whatever key
+  or position you saved when position() was called.
+*/
+int ha_redis::rnd_pos(uchar *buf, uchar *pos) {
+    DBUG_ENTER("ha_redis::rnd_pos");
+
+    ha_statistic_increment(&System_status_var::ha_read_rnd_count);
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        ulonglong seq = uint8korr(pos + sizeof(ulonglong));
+        current_id = redis_stream_id(uint8korr(pos), seq >> 1);
+        current_hedged = (seq & 1) && hedge != NULL;
+    } else {
+        my_off_t ref_pos = my_get_ptr(pos, ref_length);
+        current_position = ref_pos >> 1;
+        current_hedged = (ref_pos & 1) && hedge != NULL;
+        if (current_position == 0) {
+            DBUG_RETURN(HA_ERR_END_OF_FILE);
+        }
+        Redis_trx::Row own;
+        if (trx && trx->find_position(share->table_name, current_position, &own)) {
+            int rc = read_own_row(buf, own);
+            DBUG_RETURN(rc == HA_ERR_KEY_NOT_FOUND ? HA_ERR_RECORD_DELETED : rc);
+        }
+    }
+
+    redisContext *conn = current_hedged ? hedge : c;
+    redisReply *rr;
+    const redisReply *row = NULL;  // NULL if the row was deleted
+    bool valid;
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        rr = redis_eval(conn, REDIS_SCRIPT_STREAM_FETCH, {share->table_name},
+                        {current_id, current_id, "1", ""});
+        valid = rr && rr->type == REDIS_REPLY_ARRAY;
+        if (valid && rr->elements >= 4) {
+            row = rr->element[3];
+        }
+    } else if (share->layout == REDIS_LAYOUT_BUCKETS) {
+        std::string bucket = redis_bucket_name(share->table_name,
+                                               current_position / REDIS_BUCKET_ROWS);
+        rr = redis_call(conn, {"HGET", bucket, std::to_string(current_position % REDIS_BUCKET_ROWS)},
+                        true);
+        valid = rr && (rr->type == REDIS_REPLY_STRING || rr->type == REDIS_REPLY_NIL);
+        if (valid && rr->type == REDIS_REPLY_STRING) {
+            row = rr;
+        }
+    } else {
+        // fetch exactly the row at current_position, a tombstone comes back empty
+        rr = redis_eval(conn, REDIS_SCRIPT_FETCH, {share->table_name},
+                        {std::to_string(current_position - 1), "1"});
+        valid = rr && rr->type == REDIS_REPLY_ARRAY;
+        if (valid && rr->elements >= 3) {
+            row = rr->element[2];
+        }
+    }
+    if (!rr) {
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    if (!valid || row == NULL) {
+        freeReplyObject(rr);
+        DBUG_RETURN(valid ? HA_ERR_RECORD_DELETED : HA_ERR_INTERNAL_ERROR);
+    }
+    current_row.assign(row->str, row->len);
+    freeReplyObject(rr);
+    if (row_expired(current_row.data(), current_row.length())) {
+        DBUG_RETURN(HA_ERR_RECORD_DELETED);
+    }
+
+    row_arena.reset();
+    int rc = fetch_blobs(conn, &row_arena, current_row.data(), current_row.length(),
+                         &row_blobs);
+    if (rc) {
+        DBUG_RETURN(rc);
+    }
+    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
+    rc = unpack_row(buf, current_row.data(), current_row.length(), &row_blobs);
+    tmp_restore_column_map(table->write_set, org_bitmap);
+
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  ::info() is used to return information to the optimizer. See my_base.h for
+  the complete description.
+
+  You will probably want to have the following in your code:
+  @code
+  if (records < 2)
+    records = 2;
+  @endcode
+  The reason is that the server will optimize for cases of only a single
+  record. If, in a table scan, you don't know the number of records, it
+  will probably be better to set records to two so you can return as many
+  records as you need. Along with records, a few more variables you may wish
+  to set are:
+    records
+    deleted
+    data_file_length
+    index_file_length
+    delete_length
+    check_time
+  Take a look at the public variables in handler.h for more information.
+*/
+int ha_redis::info(uint flag) {
+    DBUG_ENTER("ha_redis::info");
+    if (stats.records < 2) {
+        stats.records = 2;
+    }
+    if ((flag & HA_STATUS_AUTO) && table->found_next_number_field) {
+        Redis_auto_inc &ai = share->auto_inc;
+        ulonglong next, last;
+        {
+            std::lock_guard<std::mutex> guard(ai.mutex);
+            next = std::max(ai.next, ai.floor + 1);
+            last = ai.last;
+        }
+        if (next > last && primary && stream_pending.empty()) {
+            // nothing reserved here: the counter tells
+            redisReply *rr = redis_call(primary, {"GET", share->auto_inc_name}, true);
+            if (rr && rr->type == REDIS_REPLY_STRING) {
+                next = std::max(next, strtoull(rr->str, NULL, 10) + 1);
+            }
+            if (rr) {
+                freeReplyObject(rr);
+            }
+        }
+        stats.auto_increment_value = next;
+    }
+    // the row a duplicate key error collided with
+    if (flag & HA_STATUS_ERRKEY) {
+        errkey = 0;
+        my_store_ptr(dup_ref, ref_length, dup_position << 1);
+    }
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Go over the live rows inside Redis, REDIS_COUNT_CHUNK rows per script
+  call, which only returns its result for the chunk; the results are
+  added up here. Tombstones and expired rows are left out.
+
+  @param hashes  add up the hashes of the rows modulo 2^32, as the live
+                 checksum does, instead of counting them
+*/
+int ha_redis::sum_rows(bool hashes, ulonglong *total) {
+    DBUG_ENTER("ha_redis::sum_rows");
+    std::string from = (share->layout == REDIS_LAYOUT_STREAM) ? "-" : "0";
+    const std::string chunk = std::to_string(REDIS_COUNT_CHUNK);
+    const std::string expiry = share->expires() ? "expiry" : "";
+    const std::string mode = hashes ? "checksum" : "";
+    const std::string reclaim = reclaims() ? "reclaim" : "";
+    ulonglong sum = 0;
+    for (;;) {
+        Redis_args keys = (share->layout == REDIS_LAYOUT_BUCKETS)
+                              ? chunk_keys(strtoull(from.c_str(), NULL, 10), REDIS_COUNT_CHUNK)
+                              : row_keys();
+        redisReply *rr = redis_eval(c, layout_script(REDIS_SCRIPT_COUNT), keys,
+                                    {from, chunk, expiry, mode, reclaim});
+        if (!rr) {
+            DBUG_RETURN(HA_ERR_NO_CONNECTION);
+        }
+        if (rr->type != REDIS_REPLY_ARRAY || rr->elements < 1 ||
+            rr->element[0]->type != REDIS_REPLY_INTEGER) {
+            freeReplyObject(rr);
+            DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+        }
+        sum += rr->element[0]->integer;
+        bool more = rr->elements > 1;
+        if (more) {
+            const redisReply *next = rr->element[1];
+            from = (next->type == REDIS_REPLY_INTEGER) ? std::to_string(next->integer)
+                                                       : std::string(next->str, next->len);
+        }
+        freeReplyObject(rr);
+        if (!more) {
+            break;
+        }
+    }
+    *total = hashes ? (sum & 0xffffffffULL) : sum;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  The exact number of rows, for SELECT COUNT(*) without WHERE, counted
+  inside Redis (see sum_rows()).
+*/
+int ha_redis::records(ha_rows *num_rows) {
+    DBUG_ENTER("ha_redis::records");
+    ulonglong count;
+    int rc = check_own_writes();
+    if (!rc) {
+        rc = sum_rows(false, &count);
+    }
+    if (rc) {
+        DBUG_RETURN(rc);
+    }
+    *num_rows = count;
+    stats.records = count;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  The live checksum of a table created with redis_checksum=on, for
+  CHECKSUM TABLE. The write scripts keep it up to date (see ROW_CHECKSUM
+  in redis_scripts.cc), so no row is read. It hashes the rows as Redis
+  stores them: it only compares with the checksum of another Redis table
+  of the same columns, never with the one of a table of another engine
+  (CHECKSUM TABLE ... EXTENDED computes that one). It is read from the
+  primary, a replica may not have the last writes yet.
+*/
+ha_checksum ha_redis::checksum() const {
+    if (primary == NULL || share->checksum_name.empty()) {
+        return 0;
+    }
+    ha_checksum sum = 0;
+    redisReply *rr = redis_call(primary, {"GET", share->checksum_name}, true);
+    if (rr && rr->type == REDIS_REPLY_STRING) {
+        sum = (ha_checksum)strtoul(rr->str, NULL, 10);
+    }
+    if (rr) {
+        freeReplyObject(rr);
+    }
+    return sum;
+}
+
+/**
+  @brief
+  A multi-row INSERT or LOAD DATA begins: inserts into a stream table are
+  pipelined until end_bulk_insert().
+*/
+void ha_redis::start_bulk_insert(ha_rows) {
+    bulk_insert = true;
+}
+
+int ha_redis::end_bulk_insert() {
+    DBUG_ENTER("ha_redis::end_bulk_insert");
+    bulk_insert = false;
+    int rc = stream_flush();
+    if (rc) {
+        // the server reports my_errno
+        set_my_errno(rc);
+    }
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  extra() is called whenever the server wishes to send a hint to
+  the storage engine. The myisam engine implements the most hints.
+  ha_innodb.cc has the most exhaustive list of these hints.
+
+  HA_EXTRA_WRITE_CAN_REPLACE comes with a REPLACE whose table has no
+  delete triggers: write_row() may then overwrite the row holding the key
+  instead of failing with a duplicate key, which the server would answer
+  with a read and an update of that row.
+
+    @see
+  ha_innodb.cc
+*/
+int ha_redis::extra(enum ha_extra_function operation) {
+    DBUG_ENTER("ha_redis::extra");
+    switch (operation) {
+        case HA_EXTRA_WRITE_CAN_REPLACE:
+            write_can_replace = true;
+            break;
+        case HA_EXTRA_WRITE_CANNOT_REPLACE:
+            write_can_replace = false;
+            break;
+        default:
+            break;
+    }
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  An integer constant of a pushed condition as the scan scripts compare
+  it (see ROW_FILTER in redis_scripts.cc): a byte which is 0 for a
+  negative number, and the 64 bits of its two's complement, most
+  significant byte first.
+*/
+static std::string redis_filter_value(longlong value, bool is_unsigned) {
+    std::string bytes(1, (is_unsigned || value >= 0) ? '\1' : '\0');
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        bytes += (char)(((ulonglong)value >> shift) & 0xff);
+    }
+    return bytes;
+}
+
+/**
+  @brief
+  Add a term of a pushed condition to terms if the scan scripts can
+  evaluate it: an integer column of the table compared with an integer
+  constant, or tested for NULL. columns is raised to the columns up to the
+  one it reads, keyed set if that column is part of a key.
+*/
+bool ha_redis::push_term(const Item *term, Redis_args *terms, uint *columns, bool *keyed) const {
+    if (term->type() != Item::FUNC_ITEM) {
+        return false;
+    }
+    const Item_func *func = static_cast<const Item_func *>(term);
+    // the operator, and the one of the term with its arguments swapped
+    const char *op;
+    const char *swapped;
+    switch (func->functype()) {
+        case Item_func::EQ_FUNC:
+            op = swapped = "=";
+            break;
+        case Item_func::NE_FUNC:
+            op = swapped = "<>";
+            break;
+        case Item_func::LT_FUNC:
+            op = "<";
+            swapped = ">";
+            break;
+        case Item_func::LE_FUNC:
+            op = "<=";
+            swapped = ">=";
+            break;
+        case Item_func::GT_FUNC:
+            op = ">";
+            swapped = "<";
+            break;
+        case Item_func::GE_FUNC:
+            op = ">=";
+            swapped = "<=";
+            break;
+        case Item_func::ISNULL_FUNC:
+            op = swapped = "null";
+            break;
+        case Item_func::ISNOTNULL_FUNC:
+            op = swapped = "notnull";
+            break;
+        default:
+            return false;
+    }
+    Item *column = func->arguments()[0]->real_item();
+    Item *value = func->argument_count() > 1 ? func->arguments()[1] : NULL;
+    if (value && column->type() != Item::FIELD_ITEM) {
+        column = value->real_item();
+        value = func->arguments()[0];
+        op = swapped;
+    }
+    if (column->type() != Item::FIELD_ITEM) {
+        return false;
+    }
+    Field *field = static_cast<Item_field *>(column)->field;
+    if (field->table != table) {
+        return false;
+    }
+    switch (field->real_type()) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_LONGLONG:
+            break;
+        default:
+            return false;
+    }
+    std::string constant = redis_filter_value(0, true);
+    if (value) {
+        if (!value->basic_const_item() || value->result_type() != INT_RESULT) {
+            return false;
+        }
+        longlong v = value->val_int();
+        if (value->null_value) {
+            return false;
+        }
+        constant = redis_filter_value(v, value->unsigned_flag);
+    }
+    terms->push_back(std::to_string(field->field_index + 1));
+    terms->push_back(op);
+    terms->push_back((field->flags & UNSIGNED_FLAG) ? "u" : "s");
+    terms->push_back(constant);
+    *columns = std::max(*columns, (uint)field->field_index + 1);
+    if (!field->part_of_key.is_clear_all()) {
+        *keyed = true;
+    }
+    return true;
+}
+
+/**
+  @brief
+  Whether the statement only counts the rows of the table: a SELECT of
+  COUNT(*) from it alone, which reads no value of the rows the scan
+  returns.
+*/
+bool ha_redis::counts_only() const {
+    SELECT_LEX *select = table->pos_in_table_list ? table->pos_in_table_list->select_lex : NULL;
+    if (select == NULL || select->leaf_table_count != 1 || !select->is_implicitly_grouped() ||
+        select->having_cond() != NULL || select->m_windows.elements != 0) {
+        return false;
+    }
+    List_iterator_fast<Item> it(select->fields_list);
+    for (Item *item = it++; item; item = it++) {
+        item = item->real_item();
+        if (item->type() != Item::SUM_FUNC_ITEM) {
+            return false;
+        }
+        Item_sum *sum = static_cast<Item_sum *>(item);
+        if (sum->sum_func() != Item_sum::COUNT_FUNC || !sum->get_arg(0)->basic_const_item() ||
+            sum->get_arg(0)->maybe_null) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  @brief
+  Push the condition of a scan down to the scan scripts, which then leave
+  out the rows failing it (see ROW_FILTER in redis_scripts.cc). Of an AND,
+  the terms push_term() takes are pushed.
+
+  @details
+  The server still evaluates the condition on the rows returned, unless
+  the whole condition was pushed, reads no key column, and the statement
+  only counts the rows (see counts_only()). The scan is then left to the
+  count scripts, which count the rows passing it in Redis; only the counts
+  and the rows they can't tell about leave Redis (see count_next()).
+*/
+const Item *ha_redis::cond_push(const Item *cond, bool) {
+    DBUG_ENTER("ha_redis::cond_push");
+    pushed.clear();
+    counted_cond = NULL;
+
+    Redis_args terms;
+    uint columns = 0;
+    bool keyed = false;
+    bool whole = true;
+    if (cond->type() == Item::COND_ITEM &&
+        static_cast<const Item_cond *>(cond)->functype() == Item_func::COND_AND_FUNC) {
+        List_iterator_fast<Item> it(
+            *const_cast<Item_cond *>(static_cast<const Item_cond *>(cond))->argument_list());
+        for (const Item *term = it++; term; term = it++) {
+            whole = push_term(term, &terms, &columns, &keyed) && whole;
+        }
+    } else {
+        whole = push_term(cond, &terms, &columns, &keyed);
+    }
+    if (terms.empty()) {
+        DBUG_RETURN(cond);
+    }
+    pushed.push_back(share->codec.layout(columns));
+    pushed.insert(pushed.end(), terms.begin(), terms.end());
+
+    if (whole && !keyed && counts_only()) {
+        counted_cond = cond;
+        DBUG_RETURN(NULL);
+    }
+    DBUG_RETURN(cond);
+}
+
+/**
+  @brief
+  The statement is over: forget the condition it pushed.
+*/
+int ha_redis::reset() {
+    DBUG_ENTER("ha_redis::reset");
+    pushed.clear();
+    counted_cond = NULL;
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  Used to delete all rows in a table, including cases of truncate and cases
+  where the optimizer realizes that all rows will be removed as a result of an
+  SQL statement.
+
+  @details
+  Called from item_sum.cc by Item_func_group_concat::clear(),
+  Item_sum_count_distinct::clear(), and Item_func_group_concat::clear().
+  Called from sql_delete.cc by mysql_delete().
+  Called from sql_select.cc by JOIN::reinit().
+  Called from sql_union.cc by st_select_lex_unit::exec().
+*/
+int ha_redis::delete_all_rows() {
+    DBUG_ENTER("ha_redis::delete_all_rows()");
+    // I can't still confirm this truncate() is called
+    // when I execute `truncate table ...`, `delete from ... (no where clause) and so on.
+
+    DBUG_RETURN(0);
+}
+
+/**
+  @brief
+  OPTIMIZE TABLE removes the tombstones left by deletes.
+  The bucket layout has none. A stream table is trimmed to its retention.
+*/
+int ha_redis::optimize(THD *, HA_CHECK_OPT *) {
+    DBUG_ENTER("ha_redis::optimize");
+    if (share->layout == REDIS_LAYOUT_BUCKETS) {
+        DBUG_RETURN(HA_ADMIN_OK);
+    }
+    if (share->layout == REDIS_LAYOUT_STREAM) {
+        std::vector<Redis_args> trim;
+        stream_trim_args(&trim);
+        for (const Redis_args &args : trim) {
+            redisReply *rr = redis_call(c, args, false);
+            if (!rr) {
+                DBUG_RETURN(HA_ADMIN_FAILED);
+            }
+            int rc = (rr->type == REDIS_REPLY_ERROR) ? HA_ADMIN_FAILED : HA_ADMIN_OK;
+            freeReplyObject(rr);
+            if (rc) {
+                DBUG_RETURN(rc);
+            }
+        }
+        DBUG_RETURN(HA_ADMIN_OK);
+    }
+
+    redisReply *rr = redis_eval(c, REDIS_SCRIPT_COMPACT, row_keys(), compact_argv());
+    if (!rr) {
+        DBUG_RETURN(HA_ADMIN_FAILED);
+    }
+    int rc = (rr->type == REDIS_REPLY_ERROR) ? HA_ADMIN_FAILED : HA_ADMIN_OK;
+    freeReplyObject(rr);
+
+    DBUG_RETURN(rc);
 }
 
 /**
   @brief
-  Used to read backwards through the index.
+  CHECK TABLE computes the checksum of the rows again, by a chunked scan
+  inside Redis, and reports a table whose live checksum drifted from it.
 */
-int ha_redis::index_prev(uchar *) {
-    int rc;
-    // DBUG_TRACE;
-    rc = HA_ERR_WRONG_COMMAND;
-    return rc;
+int ha_redis::check(THD *thd, HA_CHECK_OPT *) {
+    DBUG_ENTER("ha_redis::check");
+    if (share->checksum_name.empty()) {
+        DBUG_RETURN(HA_ADMIN_NOT_IMPLEMENTED);
+    }
+    ulonglong rows;
+    if (sum_rows(true, &rows)) {
+        DBUG_RETURN(HA_ADMIN_FAILED);
+    }
+    ha_checksum live = checksum();
+    if (live == (ha_checksum)rows) {
+        DBUG_RETURN(HA_ADMIN_OK);
+    }
+    char msg[128];
+    snprintf(msg, sizeof(msg), "live checksum %lu differs from %lu of the rows",
+             (ulong)live, (ulong)rows);
+    push_warning_printf(thd, Sql_condition::SL_WARNING, ER_GET_ERRMSG,
+                        ER_THD(thd, ER_GET_ERRMSG), HA_ERR_CRASHED, msg, "REDIS");
+    DBUG_RETURN(HA_ADMIN_CORRUPT);
 }
 
 /**
   @brief
-  index_first() asks for the first key in the index.
+  REPAIR TABLE sets the live checksum to the checksum of the rows.
 */
-int ha_redis::index_first(uchar *) {
-    int rc;
-    // DBUG_TRACE;
-    rc = HA_ERR_WRONG_COMMAND;
-    return rc;
+int ha_redis::repair(THD *, HA_CHECK_OPT *) {
+    DBUG_ENTER("ha_redis::repair");
+    if (share->checksum_name.empty()) {
+        DBUG_RETURN(HA_ADMIN_NOT_IMPLEMENTED);
+    }
+    ulonglong rows;
+    if (sum_rows(true, &rows)) {
+        DBUG_RETURN(HA_ADMIN_FAILED);
+    }
+    redisReply *rr = redis_call(c, {"SET", share->checksum_name, std::to_string(rows)}, false);
+    if (!rr) {
+        DBUG_RETURN(HA_ADMIN_FAILED);
+    }
+    int rc = (rr->type == REDIS_REPLY_ERROR) ? HA_ADMIN_FAILED : HA_ADMIN_OK;
+    freeReplyObject(rr);
+    DBUG_RETURN(rc);
 }
 
 /**
   @brief
-  index_last() asks for the last key in the index.
+  Send a command whose reply is only checked for errors.
 */
-int ha_redis::index_last(uchar *) {
-    int rc;
-    // DBUG_TRACE;
-    rc = HA_ERR_WRONG_COMMAND;
-    return rc;
+static bool redis_run(redisContext *conn, const Redis_args &args) {
+    redisReply *rr = redis_command_args(conn, args);
+    if (!rr) {
+        return false;
+    }
+    bool ok = rr->type != REDIS_REPLY_ERROR;
+    freeReplyObject(rr);
+    return ok;
 }
 
 /**
   @brief
-  rnd_init() is called when the system wants the storage engine to do a table
-  scan.
-*/
-int ha_redis::rnd_init(bool) {
-    DBUG_ENTER("ha_redis::rnd_init");
-
-    current_position = 0;
-    stats.records = 0;
+  ALTER TABLE ... SECONDARY_LOAD: copy the rows of table, a table of the
+  primary engine, into its mirror, REDIS_MIRROR_BATCH rows per RPUSH.
 
-    DBUG_RETURN(0);
-}
+  @details
+  The rows go to a new list which replaces the mirror at the end, so that
+  queries offloaded meanwhile read the previous copy. Changes to the
+  primary table don't reach the mirror: loading the table again refreshes
+  it, and a write after the copy started sends the queries back to the
+  primary table (see mirror_current()). Columns NOT SECONDARY aren't read
+  and are stored as their default.
+
+  The primary engine tells when the table was last written to in seconds,
+  so the copy doesn't start in the second of that write: a later write in
+  the same second couldn't be told from it.
+*/
+int ha_redis::load_table(const TABLE &table) {
+    DBUG_ENTER("ha_redis::load_table");
+    TABLE *t = const_cast<TABLE *>(&table);
+    std::string name = redis_mirror_name(table.s->table_name.str);
+    std::string loading = name + ":load";
+    Redis_row_codec codec;
+    codec.compile(t);
+
+    redisContext *conn = redis_connect();
+    if (conn == NULL || conn->err) {
+        if (conn) {
+            redisFree(conn);
+        }
+        my_error(ER_SECONDARY_ENGINE_PLUGIN, MYF(0), "Cannot connect to Redis");
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
 
-int ha_redis::rnd_end() {
-    DBUG_ENTER("ha_redis::rnd_end");
+    char buf[1024];
+    String scratch(buf, sizeof(buf), &my_charset_bin);
+    Redis_args push = {"RPUSH", loading};
+    std::string row;
+    t->file->info(HA_STATUS_TIME);
+    ulonglong now = my_micro_time();
+    if (t->file->stats.update_time >= now / 1000000) {
+        my_sleep(1000000 - now % 1000000);
+        now = my_micro_time();
+    }
+    std::string loaded = std::to_string(now / 1000000);
+
+    bool ok = redis_run(conn, {"DEL", loading});
+    int rc = t->file->ha_rnd_init(true);
+    while (ok && rc == 0) {
+        rc = t->file->ha_rnd_next(t->record[0]);
+        if (rc == HA_ERR_RECORD_DELETED) {
+            rc = 0;
+            continue;
+        }
+        if (rc) {
+            break;
+        }
+        my_bitmap_map *org_bitmap = tmp_use_all_columns(t, t->read_set);
+        codec.encode(t, t->record[0], &row, &scratch);
+        tmp_restore_column_map(t->read_set, org_bitmap);
+        push.push_back(row);
+        if (push.size() - 2 >= REDIS_MIRROR_BATCH) {
+            ok = redis_run(conn, push);
+            push.resize(2);
+        }
+    }
+    t->file->ha_rnd_end();
 
-    // for delete
-    std::string cmd = "LREM " + share->table_name + " 0 .";
-    redisReply *rr = (redisReply *)redisCommand(c, cmd.c_str());
-    int deleted = rr->integer;
-    deleted++; // dummy
-    freeReplyObject(rr);
+    if (rc == HA_ERR_END_OF_FILE) {
+        rc = 0;
+    }
+    if (ok && rc == 0 && push.size() > 2) {
+        ok = redis_run(conn, push);
+    }
+    if (ok && rc == 0) {
+        // an empty table leaves no list to rename, the mirror is deleted then
+        redisReply *rr = redis_eval(conn, REDIS_SCRIPT_RENAME, {loading, name}, {});
+        ok = rr && rr->type != REDIS_REPLY_ERROR;
+        if (rr) {
+            freeReplyObject(rr);
+        }
+        ok = ok && redis_run(conn, {"SET", redis_mirror_loaded_name(name), loaded});
+    }
+    if (!ok || rc) {
+        redis_run(conn, {"DEL", loading});
+    }
+    redisFree(conn);
 
-    current_position = 0;
+    if (rc) {
+        t->file->print_error(rc, MYF(0));
+        DBUG_RETURN(rc);
+    }
+    if (!ok) {
+        my_error(ER_SECONDARY_ENGINE_PLUGIN, MYF(0), "Loading the table into Redis failed");
+        DBUG_RETURN(HA_ERR_INTERNAL_ERROR);
+    }
     DBUG_RETURN(0);
 }
 
 /**
   @brief
-  This is called for each row of the table scan. When you run out of records
-  you should return HA_ERR_END_OF_FILE. Fill buff up with the row information.
-  The Field structure for the table is the key to getting data into buf
-  in a manner that will allow the server to understand it.
+  ALTER TABLE ... SECONDARY_UNLOAD, and DDL on a loaded table: delete the
+  mirror.
 */
-int ha_redis::rnd_next(uchar *buf) {
-    DBUG_ENTER("ha_redis::rnd_next");
-    ha_statistic_increment(&System_status_var::ha_read_rnd_next_count);
+int ha_redis::unload_table(const char *, const char *table_name, bool error_if_not_loaded) {
+    DBUG_ENTER("ha_redis::unload_table");
+    std::string name = redis_mirror_name(table_name);
+
+    redisContext *conn = redis_connect();
+    if (conn == NULL || conn->err) {
+        if (conn) {
+            redisFree(conn);
+        }
+        my_error(ER_SECONDARY_ENGINE_PLUGIN, MYF(0), "Cannot connect to Redis");
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+    redisReply *rr = redis_command_args(conn, {"DEL", name, redis_mirror_loaded_name(name)});
+    bool loaded = rr && rr->type == REDIS_REPLY_INTEGER && rr->integer > 0;
+    if (rr) {
+        freeReplyObject(rr);
+    }
+    redisFree(conn);
 
-    memset(buf, 0, table->s->null_bytes);
-    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
+    if (error_if_not_loaded && !loaded) {
+        my_error(ER_SECONDARY_ENGINE_PLUGIN, MYF(0), "Table is not loaded on a secondary engine");
+        DBUG_RETURN(HA_ERR_GENERIC);
+    }
+    DBUG_RETURN(0);
+}
 
-    std::string cmdstr;
+/**
+  @brief
+  Whether queries may read the mirror: it is loaded, the copy started at
+  most max_age seconds ago (0: any time), and the primary table wasn't
+  written to since.
 
-    // get length of list
-    cmdstr = "LLEN " + share->table_name;
-    redisReply *rlen = (redisReply *)redisCommand(c, cmdstr.c_str());
-    unsigned long l = rlen->integer;
-    if(l == 0 || current_position >= l) {
-        freeReplyObject(rlen);
-        tmp_restore_column_map(table->write_set, org_bitmap);
-        DBUG_RETURN(HA_ERR_END_OF_FILE);
+  @details
+  The primary engine keeps the time of the last write in memory: after a
+  restart it can't tell, and the mirror isn't read until it is loaded
+  again.
+*/
+bool ha_redis::mirror_current(ulong max_age) {
+    redisReply *rr = redis_call(primary, {"GET", redis_mirror_loaded_name(share->table_name)}, true);
+    if (rr == NULL || rr->type != REDIS_REPLY_STRING) {
+        if (rr) {
+            freeReplyObject(rr);
+        }
+        return false;
     }
-    freeReplyObject(rlen);
-
-    // get values by index
-    cmdstr = "LINDEX " + share->table_name + " " + std::to_string(current_position);
-    redisReply *rr = (redisReply *)redisCommand(c, cmdstr.c_str());
-    std::string r = rr->str;
-    buffer.length(0);
-    buffer.append(r.c_str());
+    ulonglong loaded = strtoull(rr->str, NULL, 10);
     freeReplyObject(rr);
 
-    int last_pos = 0;
-    for (Field **field = table->field; *field; field++) {
-        std::string::size_type pos = r.find(",", last_pos);
-        if (pos == std::string::npos) {
-            pos = r.length();
-        }
-        // no value means NULL
-        if(pos - last_pos == 0) {
-            (*field)->set_null();
-        } else {
-            (*field)->store(&buffer[last_pos], pos - last_pos, buffer.charset(), CHECK_FIELD_WARN);
-        }
-        last_pos = ++pos;
+    ulonglong now = my_micro_time() / 1000000;
+    if (max_age != 0 && now > loaded && now - loaded > max_age) {
+        return false;
+    }
+    handler *source = ha_get_primary_handler();
+    if (source == NULL || source->info(HA_STATUS_TIME)) {
+        return false;
     }
+    return source->stats.update_time != 0 && source->stats.update_time < loaded;
+}
+
+int ha_redis::truncate(dd::Table *) {
+    DBUG_ENTER("ha_redis::truncate()");
+    // I can't still confirm this truncate() is called when I execute `truncate table ...`
 
-    tmp_restore_column_map(table->write_set, org_bitmap);
-    current_position += 1;
-    stats.records++;
     DBUG_RETURN(0);
 }
 
 /**
   @brief
-  position() is called after each call to rnd_next() if the data needs
-  to be ordered. You can do something like the following to store
-  the position:
-  @code
-  my_store_ptr(ref, ref_length, current_position);
-  @endcode
+  Put a command of this table into the write-behind queue and remember
+  it as the last one close() waits for.
+*/
+void ha_redis::queue_behind(Redis_args &&command, uint rows) {
+    size_t mark = redis_write_behind_add(std::move(command), rows);
+    size_t last = share->behind_mark.load();
+    while (last < mark && !share->behind_mark.compare_exchange_weak(last, mark)) {
+    }
+}
+
+/**
+  @brief
+  This create a lock on the table. If you are implementing a storage engine
+  that can handle transacations look at ha_berkely.cc to see how you will
+  want to go about doing this. Otherwise you should consider calling flock()
+  here. Hint: Read the section "locking functions for mysql" in lock.cc to
+  understand this.
 
   @details
-  The server uses ref to store data. ref_length in the above case is
-  the size needed to store current_position. ref is just a byte array
-  that the server will maintain. If you are using offsets to mark rows, then
-  current_position should be the offset. If it is a primary key like in
-  BDB, then it needs to be a primary key.
+  Called from lock.cc by lock_external() and unlock_external(). Also called
+  from sql_table.cc by copy_data_between_tables().
 */
-void ha_redis::position(const uchar *) {
-    my_store_ptr(ref, ref_length, current_position);
+int ha_redis::external_lock(THD *thd, int lock_type) {
+    DBUG_ENTER("ha_redis::external_lock");
+    if (lock_type == F_UNLCK) {
+        // inserts left by a bulk insert which didn't reach end_bulk_insert()
+        int rc = stream_flush();
+        if (behind_queued && share->layout == REDIS_LAYOUT_STREAM) {
+            // trimmed by the flusher once the queued inserts are in
+            std::vector<Redis_args> trim;
+            stream_trim_args(&trim);
+            for (Redis_args &args : trim) {
+                queue_behind(std::move(args), 0);
+            }
+        }
+        behind_queued = false;
+        write_behind = false;
+        write_can_replace = false;
+        bulk_insert = false;
+        trx = NULL;
+        c = primary;
+        hedge = NULL;
+        DBUG_RETURN(rc);
+    }
+    int rc = register_trx(thd);
+    if (!rc) {
+        route(thd, lock_type);
+        // a transactional statement keeps its writes for the commit
+        write_behind = lock_type == F_WRLCK && !trx && !mirror &&
+                       (share->write_behind || THDVAR(thd, write_behind));
+    }
+    DBUG_RETURN(rc);
 }
 
 /**
   @brief
-  This is like rnd_next, but you are given a position to use
-  to determine the row. The position will be of the type that you stored in
-  ref. You can use ha_get_ptr(pos,ref_length) to retrieve whatever key
-  or position you saved when position() was called.
+  Called instead of external_lock() for each statement under LOCK TABLES.
 */
-int ha_redis::rnd_pos(uchar *buf, uchar *pos) {
-    DBUG_ENTER("ha_redis::rnd_pos");
-    DBUG_PRINT("buf", ("buf in ha_redis::rnd_pos %s", buf));
-
-    ha_statistic_increment(&System_status_var::ha_read_rnd_count);
-    current_position = my_get_ptr(pos, ref_length);
+int ha_redis::start_stmt(THD *thd, thr_lock_type) {
+    DBUG_ENTER("ha_redis::start_stmt");
+    DBUG_RETURN(register_trx(thd));
+}
 
-    std::string cmdstr;
-    bool read_all = !bitmap_is_clear_all(table->write_set);
-    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
-    memset(buf, 0, table->s->null_bytes);
-
-    // get length of list
-    cmdstr = "LLEN " + share->table_name;
-    redisReply *rlen = (redisReply *)redisCommand(c, cmdstr.c_str());
-    unsigned long l = rlen->integer;
-    if(l == 0 || current_position > l) {
-        freeReplyObject(rlen);
-        tmp_restore_column_map(table->write_set, org_bitmap);
-        DBUG_RETURN(HA_ERR_END_OF_FILE);
+/**
+  @brief
+  When redis_transactional is set, attach the THD's write buffer to this
+  handler and register the engine for the statement (and the transaction).
+*/
+int ha_redis::register_trx(THD *thd) {
+    DBUG_ENTER("ha_redis::register_trx");
+    trx = NULL;
+    // a mirror is only read
+    if (mirror || !THDVAR(thd, transactional)) {
+        DBUG_RETURN(0);
     }
-    freeReplyObject(rlen);
-
-    // get values by index
-    cmdstr = "LINDEX " + share->table_name + " " + std::to_string(current_position-1);
-    redisReply *rr = (redisReply *)redisCommand(c, cmdstr.c_str());
-    std::string r = rr->str;
-    buffer.length(0);
-    buffer.append(r.c_str());
-    freeReplyObject(rr);
 
-    int last_pos = 0;
-    for (Field **field = table->field; *field; field++) {
-        if (read_all || bitmap_is_set(table->read_set, (*field)->field_index)) {
-            std::string::size_type p = r.find(",", last_pos);
-            if (p == std::string::npos) {
-                p = r.length();
-            }
-            (*field)->store(&buffer[last_pos], p - last_pos, buffer.charset(), CHECK_FIELD_IGNORE);
-            last_pos = p+1 ;
-        }
+    Redis_trx *t = get_trx(thd, true);
+    if (t == NULL) {
+        DBUG_RETURN(HA_ERR_OUT_OF_MEM);
     }
 
-    tmp_restore_column_map(table->write_set, org_bitmap);
-
+    trans_register_ha(thd, false, redis_hton, NULL);
+    if (thd_test_options(thd, OPTION_NOT_AUTOCOMMIT | OPTION_BEGIN)) {
+        trans_register_ha(thd, true, redis_hton, NULL);
+    }
+    trx = t;
     DBUG_RETURN(0);
 }
 
 /**
   @brief
-  ::info() is used to return information to the optimizer. See my_base.h for
-  the complete description.
-
-  You will probably want to have the following in your code:
-  @code
-  if (records < 2)
-    records = 2;
-  @endcode
-  The reason is that the server will optimize for cases of only a single
-  record. If, in a table scan, you don't know the number of records, it
-  will probably be better to set records to two so you can return as many
-  records as you need. Along with records, a few more variables you may wish
-  to set are:
-    records
-    deleted
-    data_file_length
-    index_file_length
-    delete_length
-    check_time
-  Take a look at the public variables in handler.h for more information.
+  Refuse to scan a table which an earlier statement of the transaction
+  wrote to: the writes are only buffered, so the scan would miss them.
+  Point reads see them instead (see read_own_row()).
 */
-int ha_redis::info(uint) {
-    DBUG_ENTER("ha_redis::info");
-    if (stats.records < 2) {
-        stats.records = 2;
+int ha_redis::check_own_writes() const {
+    if (trx && trx->wrote_before(share->table_name)) {
+        return HA_ERR_REDIS_OWN_WRITES;
     }
-    DBUG_RETURN(0);
+    return 0;
 }
 
 /**
   @brief
-  extra() is called whenever the server wishes to send a hint to
-  the storage engine. The myisam engine implements the most hints.
-  ha_innodb.cc has the most exhaustive list of these hints.
-
-    @see
-  ha_innodb.cc
+  Read a row as the buffered writes of the transaction leave it (see
+  Redis_trx::find_key()). A row with values stored out of line is refused
+  like a scan, as the values may only be in the buffer.
 */
-int ha_redis::extra(enum ha_extra_function) {
-    DBUG_ENTER("ha_redis::extra");
-    DBUG_RETURN(0);
+int ha_redis::read_own_row(uchar *buf, const Redis_trx::Row &own) {
+    DBUG_ENTER("ha_redis::read_own_row");
+    if (own.row == NULL || row_expired(own.row->data(), own.row->length())) {
+        DBUG_RETURN(HA_ERR_KEY_NOT_FOUND);
+    }
+    Redis_args ids;
+    share->codec.blob_ids(own.row->data(), own.row->length(), NULL, &ids);
+    if (!ids.empty()) {
+        DBUG_RETURN(HA_ERR_REDIS_OWN_WRITES);
+    }
+    current_position = own.position;
+    current_hedged = false;
+    current_row = *own.row;
+    my_bitmap_map *org_bitmap = tmp_use_all_columns(table, table->write_set);
+    int rc = unpack_row(buf, current_row.data(), current_row.length(), NULL);
+    tmp_restore_column_map(table->write_set, org_bitmap);
+    DBUG_RETURN(rc);
 }
 
 /**
   @brief
-  Used to delete all rows in a table, including cases of truncate and cases
-  where the optimizer realizes that all rows will be removed as a result of an
-  SQL statement.
-
-  @details
-  Called from item_sum.cc by Item_func_group_concat::clear(),
-  Item_sum_count_distinct::clear(), and Item_func_group_concat::clear().
-  Called from sql_delete.cc by mysql_delete().
-  Called from sql_select.cc by JOIN::reinit().
-  Called from sql_union.cc by st_select_lex_unit::exec().
+  Write a row of a list table which the transaction inserted and which
+  has no position yet (current_position, see REDIS_TRX_POSITION) again:
+  its buffered insert or replace is superseded by one of the new row. A
+  replace stays one only while the row keeps the key it replaced.
 */
-int ha_redis::delete_all_rows() {
-    DBUG_ENTER("ha_redis::delete_all_rows()");
-    // I can't still confirm this truncate() is called
-    // when I execute `truncate table ...`, `delete from ... (no where clause) and so on.
-
-    DBUG_RETURN(0);
+void ha_redis::rewrite_own_insert(const std::string &row, const std::string &key,
+                                  const std::string &auto_inc, const Redis_args &pairs) {
+    Redis_trx::Row own;
+    trx->find_position(share->table_name, current_position, &own);
+    const Redis_args &was = *own.args;
+    size_t first = 3 + std::stoul(was[2]);
+    redis_script_id script = (own.script == REDIS_SCRIPT_REPLACE && was[first + 1] == key)
+                                 ? REDIS_SCRIPT_REPLACE
+                                 : REDIS_SCRIPT_INSERT;
+    // the counter must still reach the value the row was inserted with
+    Redis_args argv = {row, key, auto_inc.empty() ? was[first + 2] : auto_inc};
+    argv.insert(argv.end(), pairs.begin(), pairs.end());
+    current_position = trx->supersede(own.position, true);
+    trx->add(script, row_keys(), argv, 0);
 }
 
-int ha_redis::truncate(dd::Table *) {
-    DBUG_ENTER("ha_redis::truncate()");
-    // I can't still confirm this truncate() is called when I execute `truncate table ...`
-
-    DBUG_RETURN(0);
+bool ha_redis::get_error_message(int error, String *buf) {
+    if (error == HA_ERR_REDIS_OWN_WRITES) {
+        buf->append(STRING_WITH_LEN("Table has writes of this transaction which "
+                                    "reads can't see before COMMIT"));
+    } else if (error == HA_ERR_REDIS_STREAM_ORDER) {
+        buf->append(STRING_WITH_LEN("Key is lower than the one of the last row "
+                                    "of the stream"));
+    }
+    return false;
 }
 
 /**
   @brief
-  This create a lock on the table. If you are implementing a storage engine
-  that can handle transacations look at ha_berkely.cc to see how you will
-  want to go about doing this. Otherwise you should consider calling flock()
-  here. Hint: Read the section "locking functions for mysql" in lock.cc to
-  understand this.
-
-  @details
-  Called from lock.cc by lock_external() and unlock_external(). Also called
-  from sql_table.cc by copy_data_between_tables().
+  Choose the connection the statement uses. With redis_read_from_replicas
+  set, a statement which only reads this table is served by a replica at
+  most redis_replica_max_lag bytes behind the primary; writes, and reads
+  which must see the session's own writes, stay on the primary.
 */
-int ha_redis::external_lock(THD *, int) {
-    DBUG_ENTER("ha_redis::external_lock");
-    DBUG_RETURN(0);
+void ha_redis::route(THD *thd, int lock_type) {
+    DBUG_ENTER("ha_redis::route");
+    c = primary;
+    hedge = NULL;
+    // redis_command_timeout may have changed since the last statement
+    redis_apply_timeout(primary);
+    if (lock_type != F_RDLCK || redis_replica_count() == 0 ||
+        !THDVAR(thd, read_from_replicas)) {
+        DBUG_VOID_RETURN;
+    }
+    // writes buffered by the transaction aren't even on the primary yet
+    Redis_trx *t = get_trx(thd, true);
+    if (t == NULL || t->has_writes()) {
+        DBUG_VOID_RETURN;
+    }
+
+    int r = redis_pick_replica(primary, THDVAR(thd, replica_max_lag), &t->read_point);
+    if (r < 0) {
+        DBUG_VOID_RETURN;
+    }
+    if (replica && (replica_index != r || replica->err)) {
+        redisFree(replica);
+        replica = NULL;
+    }
+    if (replica == NULL) {
+        const Redis_endpoint &endpoint = redis_replica(r);
+        replica = redis_connect_to(endpoint.host.c_str(), endpoint.port);
+        if (replica == NULL || replica->err || !redis_load_scripts(replica)) {
+            // the replica is unreachable, read from the primary
+            if (replica) {
+                redisFree(replica);
+                replica = NULL;
+            }
+            DBUG_VOID_RETURN;
+        }
+        replica_index = r;
+    }
+    redis_apply_timeout(replica);
+    c = replica;
+    // the primary is at least as recent as the replica, so it can answer too
+    hedge = primary;
+    redis_status.replica_reads++;
+    DBUG_VOID_RETURN;
 }
 
 /**
@@ -629,10 +3744,26 @@ int ha_redis::external_lock(THD *, int) {
   refer to a different thread! (this happens if get_lock_data() is called
   from mysql_lock_abort_for_thread() function)
 */
-THR_LOCK_DATA **ha_redis::store_lock(THD *, THR_LOCK_DATA **to,
+THR_LOCK_DATA **ha_redis::store_lock(THD *thd, THR_LOCK_DATA **to,
                                        enum thr_lock_type lock_type) {
     DBUG_ENTER("ha_redis::store_lock");
-    if (lock_type != TL_IGNORE && lock.type == TL_UNLOCK) lock.type = lock_type;
+    if (lock_type != TL_IGNORE && lock.type == TL_UNLOCK) {
+        /*
+          With optimistic concurrency, rows are protected by the
+          compare-and-set scripts, so writers let other readers and writers
+          in (like Berkeley DB above). LOCK TABLES and OPTIMIZE TABLE, which
+          moves rows, keep their lock.
+        */
+        if (srv_concurrency == REDIS_CONCURRENCY_OPTIMISTIC &&
+            !thd_in_lock_tables(thd) && thd_sql_command(thd) != SQLCOM_OPTIMIZE) {
+            if (lock_type >= TL_WRITE_CONCURRENT_INSERT && lock_type <= TL_WRITE) {
+                lock_type = TL_WRITE_ALLOW_WRITE;
+            } else if (lock_type == TL_READ_NO_INSERT) {
+                lock_type = TL_READ;
+            }
+        }
+        lock.type = lock_type;
+    }
     *to++ = &lock;
     DBUG_RETURN(to);
 }
@@ -657,16 +3788,20 @@ int ha_redis::delete_table(const char *table_name, const dd::Table *) {
     DBUG_ENTER("ha_redis::delete_table()");
     // Todo: Handlers are already deleted??
 
-    c = redisConnect("127.0.0.1", 6379);
+    // queued inserts would create the table again
+    redis_write_behind_flush();
+    c = redis_connect();
     if (c != NULL && c->err) {
         DBUG_RETURN(-1);
     }
-    std::string cmd = "DEL " + get_table_name(table_name);
-    redisReply *ret = (redisReply *)redisCommand(c, cmd.c_str());
+    Redis_args args = redis_table_keys(c, get_table_name(table_name));
+    args.insert(args.begin(), "DEL");
+    redisReply *ret = redis_command_args(c, args);
     if(ret) {
         freeReplyObject(ret);
     }
     redisFree(c);
+    c = NULL;
 
     DBUG_RETURN(0);
 }
@@ -679,11 +3814,73 @@ int ha_redis::delete_table(const char *table_name, const dd::Table *) {
   If you do not implement this, the default rename_table() is called from
   handler.cc and it will delete all files with the file extensions from
   handlerton::file_extensions.
+  Every key of the table is RENAMEd in one script call, so no row is copied.
 */
-int ha_redis::rename_table(const char *, const char *, const dd::Table *,
+int ha_redis::rename_table(const char *from, const char *to, const dd::Table *,
                              dd::Table *) {
-    // DBUG_TRACE;
-    return HA_ERR_WRONG_COMMAND;
+    DBUG_ENTER("ha_redis::rename_table");
+
+    redis_write_behind_flush();
+    redisContext *conn = redis_connect();
+    if (conn == NULL || conn->err) {
+        if (conn) {
+            redisFree(conn);
+        }
+        DBUG_RETURN(HA_ERR_NO_CONNECTION);
+    }
+
+    std::string from_name = get_table_name(from);
+    std::string to_name = get_table_name(to);
+    Redis_args keys = redis_table_keys(conn, from_name);
+    size_t n = keys.size();
+    for (size_t i = 0; i < n; i++) {
+        keys.push_back(to_name + keys[i].substr(from_name.length()));
+    }
+
+    int rc = 0;
+    redisReply *rr = redis_eval(conn, REDIS_SCRIPT_RENAME, keys, {});
+    if (!rr) {
+        rc = HA_ERR_NO_CONNECTION;
+    } else {
+        if (rr->type == REDIS_REPLY_ERROR) {
+            rc = HA_ERR_INTERNAL_ERROR;
+        }
+        freeReplyObject(rr);
+    }
+    redisFree(conn);
+
+    DBUG_RETURN(rc);
+}
+
+/**
+  @brief
+  Check if an ALTER TABLE can be done without copying the table.
+
+  @details
+  Adding columns at the end of the table is instant: stored rows are left
+  as they are and decode the missing trailing columns as their default
+  (see Redis_row_codec::decode()). Defaults must be constants, since they are not
+  stored. Everything else is done by the copy algorithm.
+*/
+enum_alter_inplace_result ha_redis::check_if_supported_inplace_alter(
+        TABLE *altered_table, Alter_inplace_info *ha_alter_info) {
+    DBUG_ENTER("ha_redis::check_if_supported_inplace_alter");
+
+    if (ha_alter_info->handler_flags & ~Alter_inplace_info::ADD_STORED_BASE_COLUMN) {
+        // also ALTER_STORED_COLUMN_ORDER: the column is not added at the end
+        DBUG_RETURN(HA_ALTER_INPLACE_NOT_SUPPORTED);
+    }
+
+    for (uint i = table->s->fields; i < altered_table->s->fields; i++) {
+        Field *field = altered_table->field[i];
+        if (field->m_default_val_expr != nullptr ||
+            field->has_insert_default_datetime_value_expression() ||
+            (field->flags & AUTO_INCREMENT_FLAG)) {
+            DBUG_RETURN(HA_ALTER_INPLACE_NOT_SUPPORTED);
+        }
+    }
+
+    DBUG_RETURN(HA_ALTER_INPLACE_INSTANT);
 }
 
 /**
@@ -717,18 +3914,57 @@ static MYSQL_THDVAR_UINT(create_count_thdvar, 0, NULL, NULL, NULL, 0, 0, 1000,0)
   so.
   Called from handle.cc by ha_create_table().
 */
-int ha_redis::create(const char *name, TABLE *, HA_CREATE_INFO *, dd::Table *) {
+int ha_redis::create(const char *name, TABLE *form, HA_CREATE_INFO *create_info,
+                     dd::Table *) {
+    redis_layout layout;
+    if (!redis_table_layout(form->s, &layout)) {
+        return HA_WRONG_CREATE_OPTION;
+    }
+    if (layout == REDIS_LAYOUT_STREAM) {
+        if (!redis_stream_index_supported(form)) {
+            return HA_WRONG_CREATE_OPTION;
+        }
+    } else if (form->s->keys > 0 && !(form->key_info[0].flags & HA_NOSAME)) {
+        // the only index is a hash in redis, which can't hold duplicates
+        return HA_WRONG_CREATE_OPTION;
+    }
+    int expire_field;
+    std::string ttl = redis_table_option(form->s, "redis_ttl");
+    if (!redis_expire_field(form->s, &expire_field) ||
+        (!ttl.empty() && strtoull(ttl.c_str(), NULL, 10) == 0)) {
+        return HA_WRONG_CREATE_OPTION;
+    }
+    // rows which Redis removes by itself would leave them out of the checksum
+    if (redis_table_option(form->s, "redis_checksum") == "on" &&
+        (!ttl.empty() || expire_field >= 0 ||
+         !redis_table_option(form->s, "redis_stream_maxlen").empty() ||
+         !redis_table_option(form->s, "redis_stream_retention").empty())) {
+        return HA_WRONG_CREATE_OPTION;
+    }
+
     // Initialize(re-create) table to truncate table.
-    c = redisConnect("127.0.0.1", 6379);
+    c = redis_connect();
     if (c != NULL && c->err) {
         return 0;
     }
 
-    std::string cmd = "DEL " + get_table_name(name);
-    redisReply *ret = (redisReply *)redisCommand(c, cmd.c_str());
+    // the keys of the table being recreated, in whatever layout it had
+    Redis_args args = redis_table_keys(c, get_table_name(name));
+    args.insert(args.begin(), "DEL");
+    redisReply *ret = redis_command_args(c, args);
     if(ret) {
         freeReplyObject(ret);
     }
+    // AUTO_INCREMENT = n: the counter holds the last value used
+    if (create_info->auto_increment_value > 1) {
+        ret = redis_command_args(c, {"SET", redis_auto_inc_name(get_table_name(name)),
+                                     std::to_string(create_info->auto_increment_value - 1)});
+        if (ret) {
+            freeReplyObject(ret);
+        }
+    }
+    redisFree(c);
+    c = NULL;
 
     /*
       It's just an redis of THDVAR_SET() usage below.
@@ -818,6 +4054,23 @@ static SYS_VAR *redis_system_variables[] = {
         MYSQL_SYSVAR(signed_long_thdvar),
         MYSQL_SYSVAR(signed_longlong_var),
         MYSQL_SYSVAR(signed_longlong_thdvar),
+        MYSQL_SYSVAR(scan_batch_size),
+        MYSQL_SYSVAR(transactional),
+        MYSQL_SYSVAR(commit_wait_replicas),
+        MYSQL_SYSVAR(commit_wait_timeout),
+        MYSQL_SYSVAR(concurrency),
+        MYSQL_SYSVAR(host),
+        MYSQL_SYSVAR(port),
+        MYSQL_SYSVAR(replicas),
+        MYSQL_SYSVAR(read_from_replicas),
+        MYSQL_SYSVAR(replica_max_lag),
+        MYSQL_SYSVAR(command_timeout),
+        MYSQL_SYSVAR(hedge_percentile),
+        MYSQL_SYSVAR(blob_inline_limit),
+        MYSQL_SYSVAR(secondary_max_age),
+        MYSQL_SYSVAR(write_behind),
+        MYSQL_SYSVAR(write_behind_interval),
+        MYSQL_SYSVAR(write_behind_queue_size),
         NULL};
 
 // this is an redis of SHOW_FUNC
@@ -861,6 +4114,15 @@ static SHOW_VAR func_status[] = {
         {"redis_status_var5", (char *)&redis_vars.var5, SHOW_BOOL,SHOW_SCOPE_GLOBAL},
         {"redis_status_var6", (char *)&redis_vars.var6, SHOW_LONG,SHOW_SCOPE_GLOBAL},
         {"redis_status", (char *)show_array_redis, SHOW_ARRAY,SHOW_SCOPE_GLOBAL},
+        {"redis_optimistic_conflicts", (char *)&redis_status.conflicts, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_replica_reads", (char *)&redis_status.replica_reads, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_deadline_expirations", (char *)&redis_io_status.deadline_expirations, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_hedged_reads", (char *)&redis_io_status.hedged_reads, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_hedge_wins", (char *)&redis_io_status.hedge_wins, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_write_behind_queued", (char *)&redis_write_behind_status.queued, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_write_behind_flushed", (char *)&redis_write_behind_status.flushed, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_write_behind_failed", (char *)&redis_write_behind_status.failed, SHOW_LONG, SHOW_SCOPE_GLOBAL},
+        {"redis_write_behind_stalls", (char *)&redis_write_behind_status.stalls, SHOW_LONG, SHOW_SCOPE_GLOBAL},
         {0, 0, SHOW_UNDEF, SHOW_SCOPE_UNDEF}};
 
 mysql_declare_plugin(redis){
@@ -872,10 +4134,26 @@ mysql_declare_plugin(redis){
                                      PLUGIN_LICENSE_GPL,
                                      redis_init_func, /* Plugin Init */
                                      NULL,              /* Plugin check uninstall */
-                                     NULL,              /* Plugin Deinit */
+                                     redis_deinit_func, /* Plugin Deinit */
                                      0x0001 /* 0.1 */,
                                      func_status,              /* status variables */
                                      redis_system_variables, /* system variables */
                                      NULL,                     /* config options */
                                      0,                        /* flags */
+                             },
+                             {
+                                     MYSQL_STORAGE_ENGINE_PLUGIN,
+                                     &redis_storage_engine,
+                                     "REDIS_SECONDARY",
+                                     "tom__bo",
+                                     "Redis mirror of tables of other engines (SECONDARY_ENGINE)",
+                                     PLUGIN_LICENSE_GPL,
+                                     redis_secondary_init_func, /* Plugin Init */
+                                     NULL,              /* Plugin check uninstall */
+                                     NULL,              /* Plugin Deinit */
+                                     0x0001 /* 0.1 */,
+                                     NULL,                     /* status variables */
+                                     NULL,                     /* system variables */
+                                     NULL,                     /* config options */
+                                     0,                        /* flags */
                              } mysql_declare_plugin_end;
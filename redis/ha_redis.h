@@ -32,6 +32,12 @@
 */
 
 #include <sys/types.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "my_base.h" /* ha_rows */
 #include "my_compiler.h"
@@ -41,6 +47,50 @@
 #include "thr_lock.h"    /* THR_LOCK, THR_LOCK_DATA */
 
 #include "hiredis.h" /* for redis */
+#include "redis_arena.h"
+#include "redis_codec.h"
+#include "redis_replication.h"
+#include "redis_scripts.h"
+
+/** Rows a bulk insert into a stream table sends in one script call */
+#define REDIS_STREAM_BATCH 128
+
+/** Rows pushed per RPUSH when a table is loaded into its mirror */
+#define REDIS_MIRROR_BATCH 1000
+
+/** Rows one call of a count script looks at (see ha_redis::records()) */
+#define REDIS_COUNT_CHUNK 10000
+
+/** How the rows of a table are kept, chosen by COMMENT 'redis_layout=...' */
+enum redis_layout {
+    REDIS_LAYOUT_LIST,     ///< a list, positions are list indexes (default)
+    REDIS_LAYOUT_BUCKETS,  ///< hashes of REDIS_BUCKET_ROWS rows
+    REDIS_LAYOUT_STREAM    ///< an append-only stream, positions are entry IDs
+};
+
+/** Largest range of auto increment values reserved at once */
+#define REDIS_AUTO_INC_MAX_RANGE 65536
+/** A range used up faster than this (microseconds) makes the next one larger */
+#define REDIS_AUTO_INC_FAST (1000 * 1000)
+/** A range lasting longer than this (microseconds) makes the next one smaller */
+#define REDIS_AUTO_INC_SLOW (10 * 1000 * 1000)
+
+/** @brief
+  Auto increment values reserved from the table's counter by this server,
+  or the row ids of a bucket table reserved from its hash (see
+  ha_redis::next_row_id()). They are handed out by every handler of the
+  table without a round trip, until the range is used up.
+*/
+struct Redis_auto_inc {
+    std::mutex mutex;
+    ulonglong next;         ///< next value to hand out
+    ulonglong last;         ///< last value of the reserved range, 0 if none
+    ulonglong floor;        ///< highest value inserted explicitly
+    ulonglong range;        ///< number of values the next reservation takes
+    ulonglong reserved_at;  ///< my_micro_time() of the last reservation
+
+    Redis_auto_inc() : next(0), last(0), floor(0), range(1), reserved_at(0) {}
+};
 
 /** @brief
   Redis_share is a class that will be shared among all open handlers.
@@ -50,8 +100,108 @@ class Redis_share : public Handler_share {
 public:
     THR_LOCK lock;
     std::string table_name;
+    std::string index_name;  ///< hash of the unique index, empty if none
+    std::string blob_name;   ///< hash of the out-of-line values
+    redis_layout layout;     ///< how the rows are kept
+    ulonglong stream_maxlen;     ///< stream tables: entries kept, 0 for all
+    ulonglong stream_retention;  ///< stream tables: seconds rows are kept, 0 for ever
+    ulonglong ttl;           ///< seconds a row lives after it is written, 0 for ever
+    int expire_field;        ///< column holding the time a row expires at, -1 if none
+    bool write_behind;       ///< inserts are queued (redis_write_behind=on)
+    std::atomic<size_t> behind_mark;  ///< mark of the last write-behind command of the table
+    std::string checksum_name;  ///< key of the live checksum, empty if none
+    std::string auto_inc_name;  ///< counter of the AUTO_INCREMENT column
+    std::string free_name;   ///< list tables: positions of the tombstones, else empty
+    std::string last_name;   ///< stream tables: ID of the last entry deleted, else empty
+    Redis_auto_inc auto_inc;
+    Redis_auto_inc row_ids;  ///< bucket tables: row ids of new rows
+    Redis_row_codec codec;   ///< row format of the table
     Redis_share();
     ~Redis_share() { thr_lock_delete(&lock); }
+
+    /** Rows of the table can expire (see ha_redis::row_expiry()) */
+    bool expires() const { return ttl > 0 || expire_field >= 0; }
+};
+
+/** Error of a read of a table with writes its transaction hasn't applied yet */
+#define HA_ERR_REDIS_OWN_WRITES (HA_ERR_LAST + 1)
+
+/** Error of an insert into a stream table of a key lower than the last one */
+#define HA_ERR_REDIS_STREAM_ORDER (HA_ERR_LAST + 2)
+
+/** Times a commit is verified again when the verified tables change before EXEC */
+#define REDIS_TRX_ATTEMPTS 3
+
+/**
+  Flag of the position of a row which a transaction inserted into a list
+  table: the row gets its position at commit, until then it has the number
+  of the buffered write instead (see Redis_trx::find_position())
+*/
+#define REDIS_TRX_POSITION (1ULL << 62)
+
+/** @brief
+  Redis_trx buffers the writes of a transactional statement or transaction.
+  It is attached to the THD and applied at commit by one MULTI ... EXEC,
+  or thrown away at rollback.
+  The writes are checked before EXEC, so that they are applied all or
+  none: see flush().
+  Point reads see the rows as the buffered writes leave them: see
+  find_key() and find_position().
+  It also keeps the read point which decides whether the session may read
+  from a replica.
+*/
+class Redis_trx {
+    /** A buffered script call */
+    struct Write {
+        redis_script_id script;
+        Redis_args args;     ///< complete EVALSHA arguments
+        ulonglong position;  ///< position of the row written, 0 if only EXEC decides it
+        size_t dropped;      ///< statement which superseded the write, 0 if none did
+        size_t next;         ///< the write superseding it, 0 if the row was deleted
+    };
+
+    redisContext *conn;                       ///< connection the buffer is flushed on
+    std::vector<Write> writes;                ///< buffered writes, in statement order
+    std::map<std::string, std::vector<size_t>> keyed;   ///< writes by table and index key
+    std::map<std::string, std::vector<size_t>> placed;  ///< writes by table and position
+    size_t stmt_mark;                         ///< writes.size() at statement start
+    size_t statement;                         ///< number of the statement, from 1
+    size_t pending;                           ///< replies of UNWATCH not read yet
+
+    bool connect();
+    int verify(bool load, bool *lost);
+    int exec(THD *thd, uint wait_replicas, ulong wait_timeout, bool *raced);
+
+public:
+    /** A row as the buffered writes leave it */
+    struct Row {
+        ulonglong position;       ///< its position, or'ed with REDIS_TRX_POSITION if it has none yet
+        const std::string *row;   ///< the row, NULL if the writes deleted it
+        redis_script_id script;   ///< script of the write which wrote it last
+        const Redis_args *args;   ///< EVALSHA arguments of that write
+    };
+
+    Redis_read_point read_point;              ///< what the session's reads must see
+
+    Redis_trx() : conn(NULL), stmt_mark(0), statement(1), pending(0) {}
+    ~Redis_trx() {
+        if (conn) redisFree(conn);
+    }
+
+    void add(redis_script_id script, const Redis_args &keys, const Redis_args &argv,
+             ulonglong position);
+    int flush(THD *thd, uint wait_replicas, ulong wait_timeout);
+    void end_statement() {
+        stmt_mark = writes.size();
+        statement++;
+    }
+    void rollback_statement();
+    void discard();
+    bool has_writes() const { return !writes.empty(); }
+    bool wrote_before(const std::string &table) const;
+    bool find_key(const std::string &table, const std::string &key, Row *found) const;
+    bool find_position(const std::string &table, ulonglong position, Row *found) const;
+    ulonglong supersede(ulonglong position, bool moved);
 };
 
 /** @brief
@@ -61,14 +211,92 @@ class ha_redis : public handler {
     THR_LOCK_DATA lock;        ///< MySQL lock
     Redis_share *share;        ///< Shared lock info
     Redis_share *get_share();  ///< Get the share
-
-    redisContext *c;
-    unsigned long current_position;
-    String buffer;
+    bool mirror;               ///< secondary engine: the table mirrors one of another engine
+    bool live_checksum;        ///< the table keeps a checksum (redis_checksum=on)
+
+    redisContext *c;                 ///< connection of the current statement
+    redisContext *primary;           ///< connection to the primary
+    redisContext *replica;           ///< connection to a replica, opened on demand
+    int replica_index;               ///< replica the connection goes to
+    redisContext *hedge;             ///< where point reads are hedged to, NULL if nowhere
+    bool current_hedged;             ///< the last row read came from hedge
+    unsigned long current_position;  ///< 1-based position of the last row read
+    unsigned long scan_position;     ///< list index the next fetch starts at
+    bool null_lookup;                ///< index_read_map() scans for a key with a NULL part
+    std::string null_key;            ///< that key, with null flags (see pack_key())
+    unsigned long dup_position;      ///< position of the row a duplicate key hit
+    std::string current_id;          ///< stream tables: entry ID of the last row read
+    std::string stream_from;         ///< stream tables: ID the next fetch starts at, empty at the end
+    std::string stream_to;           ///< stream tables: ID the current read ends at
+    bool stream_reverse;             ///< stream tables: the current read goes backwards
+    ulonglong stream_key_read;       ///< stream tables: key index_read_map() looked for
+    Redis_args stream_pending;       ///< rows of a bulk insert not sent yet, see stream_append()
+    bool bulk_insert;                ///< between start_bulk_insert() and end_bulk_insert()
+    bool write_behind;               ///< inserts of the statement go to the write-behind queue
+    bool behind_queued;              ///< the statement queued inserts
+    bool write_can_replace;          ///< REPLACE: write_row() overwrites a duplicate
+    std::string current_row;         ///< encoded image of the last row read
+    std::string previous_row;        ///< image current_row had before update_row()
+    redisReply *scan_reply;          ///< rows prefetched by the current scan
+    Redis_reply_arena scan_arena;    ///< memory scan_reply is built in
+    size_t scan_element;             ///< next element of scan_reply to return
+    Redis_blob_cursor scan_blobs;    ///< out-of-line values of the scan batch
+    Redis_reply_arena row_arena;     ///< memory of the out-of-line values of a point read
+    Redis_blob_cursor row_blobs;     ///< out-of-line values of a point read
+    Redis_trx *trx;                  ///< write buffer, NULL if not transactional
+    Redis_args pushed;               ///< pushed condition, as ARGV of the scan scripts (see cond_push())
+    const Item *counted_cond;        ///< condition left to the handler by a scan which only counts
+    ulonglong counted;               ///< rows that scan still returns without reading them
+    std::string count_from;          ///< where that scan counts on, empty at the end
+
+    void pack_row(std::string *record, Redis_blob_writes *blobs);
+    ulonglong row_expiry();
+    bool row_expired(const char *row, size_t length) const;
+    bool reclaims() const;
+    size_t blob_limit() const;
+    Redis_args compact_argv() const;
+    int unpack_row(uchar *buf, const char *row, size_t length,
+                   Redis_blob_cursor *blobs);
+    int fetch_blobs(redisContext *conn, Redis_reply_arena *arena, const char *row,
+                    size_t length, Redis_blob_cursor *blobs);
+    bool pack_key(const uchar *record, std::string *key, bool null_flags = false);
+    Redis_args row_keys() const;
+    Redis_args write_keys(ulonglong id, ulonglong held) const;
+    Redis_args chunk_keys(ulonglong first, ulonglong rows) const;
+    int next_row_id(ulonglong *id);
+    int key_holder(const std::string &key, ulonglong *held);
+    int sum_rows(bool hashes, ulonglong *total);
+    redis_script_id layout_script(redis_script_id script) const;
+    bool note_auto_increment(ulonglong value);
+    int fetch_rows();
+    int fetch_stream_rows();
+    bool push_term(const Item *term, Redis_args *terms, uint *columns, bool *keyed) const;
+    bool counts_only() const;
+    int fetch_counts();
+    int count_next(uchar *buf);
+    int read_next(uchar *buf);
+    int next_null_key(uchar *buf);
+    ulonglong stream_key(const uchar *record);
+    int stream_seek(uchar *buf, const std::string &from, bool reverse);
+    int stream_append(const Redis_args &argv);
+    int stream_flush();
+    void stream_trim_args(std::vector<Redis_args> *commands);
+    void free_scan_reply();
+    int run_write(redis_script_id script, Redis_args keys, Redis_args argv,
+                  ulonglong position, size_t held_arg = 0);
+    void queue_behind(Redis_args &&command, uint rows);
+    int register_trx(THD *thd);
+    int check_own_writes() const;
+    int read_own_row(uchar *buf, const Redis_trx::Row &own);
+    void rewrite_own_insert(const std::string &row, const std::string &key,
+                            const std::string &auto_inc, const Redis_args &pairs);
+    void route(THD *thd, int lock_type);
+    redisReply *point_read(redis_script_id script, const Redis_args &keys,
+                           const Redis_args &argv);
 
 public:
     ha_redis(handlerton *hton, TABLE_SHARE *table_arg);
-    ~ha_redis() {}
+    ~ha_redis() { free_scan_reply(); }
     const char *table_type() const { return "REDIS"; }
 
     /**
@@ -90,7 +318,10 @@ public:
       implements. The current table flags are documented in handler.h
     */
     ulonglong table_flags() const {
-        return HA_BINLOG_STMT_CAPABLE;
+        // a mirror holds the rows only, its indexes are those of the primary table
+        return HA_BINLOG_STMT_CAPABLE | HA_BINLOG_ROW_CAPABLE | HA_NULL_IN_KEY |
+               (mirror ? HA_NO_INDEX_ACCESS : 0) |
+               (live_checksum ? HA_HAS_CHECKSUM : 0);
     }
 
     /** @brief
@@ -102,12 +333,13 @@ public:
       part is the key part to check. First key part is 0.
       If all_parts is set, MySQL wants to know the flags for the combined
       index, up to and including 'part'.
+
+        @details
+      The only index is a unique hash index (a hash in redis), which can
+      only be searched for a whole key. The index of a stream table is the
+      order of the stream, which can be read by ranges in both directions.
     */
-    ulong index_flags(uint inx MY_ATTRIBUTE((unused)),
-                      uint part MY_ATTRIBUTE((unused)),
-                      bool all_parts MY_ATTRIBUTE((unused))) const {
-        return 0;
-    }
+    ulong index_flags(uint inx, uint part, bool all_parts) const;
 
     /** @brief
      * retrieve table name from path
@@ -136,32 +368,25 @@ public:
       here; MySQL will do min(your_limits, MySQL_limits) automatically.
 
         @details
-      There is no need to implement ..._key_... methods if your engine doesn't
-      support indexes.
+      A table can have one unique index (PRIMARY KEY or UNIQUE).
      */
-    uint max_supported_keys() const { return 0; }
+    uint max_supported_keys() const { return 1; }
 
     /** @brief
       unireg.cc will call this to make sure that the storage engine can handle
       the data it is about to send. Return *real* limits of your storage engine
       here; MySQL will do min(your_limits, MySQL_limits) automatically.
 
-        @details
-      There is no need to implement ..._key_... methods if your engine doesn't
-      support indexes.
      */
-    uint max_supported_key_parts() const { return 0; }
+    uint max_supported_key_parts() const { return MAX_REF_PARTS; }
 
     /** @brief
       unireg.cc will call this to make sure that the storage engine can handle
       the data it is about to send. Return *real* limits of your storage engine
       here; MySQL will do min(your_limits, MySQL_limits) automatically.
 
-        @details
-      There is no need to implement ..._key_... methods if your engine doesn't
-      support indexes.
      */
-    uint max_supported_key_length() const { return 0; }
+    uint max_supported_key_length() const { return MAX_KEY_LENGTH; }
 
     /** @brief
       Called in test_quick_select to determine if indexes should be used.
@@ -204,20 +429,42 @@ public:
     int rnd_pos(uchar *buf, uchar *pos);  ///< required
     void position(const uchar *record);   ///< required
     int info(uint);                       ///< required
+    int records(ha_rows *num_rows);
+    ha_checksum checksum() const;
+    bool get_error_message(int error, String *buf);
+    void start_bulk_insert(ha_rows rows);
+    int end_bulk_insert();
     int extra(enum ha_extra_function operation);
+    const Item *cond_push(const Item *cond, bool other_tbls_ok);
+    int reset();
+    void get_auto_increment(ulonglong offset, ulonglong increment,
+                            ulonglong nb_desired_values, ulonglong *first_value,
+                            ulonglong *nb_reserved_values);
     int external_lock(THD *thd, int lock_type);  ///< required
+    int start_stmt(THD *thd, thr_lock_type lock_type);
     int delete_all_rows(void);
+    int optimize(THD *thd, HA_CHECK_OPT *check_opt);
+    int check(THD *thd, HA_CHECK_OPT *check_opt);
+    int repair(THD *thd, HA_CHECK_OPT *check_opt);
     int truncate(dd::Table *);
+    int load_table(const TABLE &table);
+    int unload_table(const char *db_name, const char *table_name, bool error_if_not_loaded);
+    bool mirror_current(ulong max_age);
     ha_rows records_in_range(uint inx, key_range *min_key, key_range *max_key);
     int delete_table(const char *from, const dd::Table *table_def);
     int rename_table(const char *from, const char *to, const dd::Table *from_table_def, dd::Table *to_table_def);
+    enum_alter_inplace_result check_if_supported_inplace_alter(TABLE *altered_table,
+                                                               Alter_inplace_info *ha_alter_info);
     THR_LOCK_DATA **store_lock(THD *thd, THR_LOCK_DATA **to, enum thr_lock_type lock_type);  ///< required
     /** @brief
       We implement below methods in ha_redis.cc. It's not an obligatory method;
       skip it and and MySQL will treat it as not implemented.
     */
+    int index_init(uint idx, bool sorted);
     int index_read_map(uchar *buf, const uchar *key, key_part_map keypart_map, enum ha_rkey_function find_flag);
+    int index_end();
     int index_next(uchar *buf);
+    int index_next_same(uchar *buf, const uchar *key, uint keylen);
     int index_prev(uchar *buf);
     int index_first(uchar *buf);
     int index_last(uchar *buf);
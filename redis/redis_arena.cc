@@ -0,0 +1,182 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/**
+  @file redis_arena.cc
+
+  @brief
+  Reply builders which allocate from a Redis_reply_arena.
+
+  @details
+  The builders do what hiredis' default ones do (see createReplyObject()
+  in hiredis.c): create the object and hook it into its parent array.
+*/
+
+#include "redis_arena.h"
+
+#include <string.h>
+
+#include "my_sys.h"
+#include "mysql/psi/psi_memory.h"
+
+Redis_reply_arena::~Redis_reply_arena() {
+    for (Block &block : blocks) {
+        my_free(block.data);
+    }
+}
+
+void *Redis_reply_arena::alloc(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+
+    if (current < blocks.size() && used + size <= blocks[current].size) {
+        void *p = blocks[current].data + used;
+        used += size;
+        return p;
+    }
+    // move on to the next block which is large enough
+    for (current++; current < blocks.size(); current++) {
+        if (size <= blocks[current].size) {
+            used = size;
+            return blocks[current].data;
+        }
+    }
+
+    size_t block_size = size > REDIS_ARENA_BLOCK_SIZE ? size : REDIS_ARENA_BLOCK_SIZE;
+    char *data = (char *)my_malloc(PSI_NOT_INSTRUMENTED, block_size, MYF(MY_WME));
+    if (data == NULL) {
+        return NULL;
+    }
+    blocks.push_back({data, block_size});
+    current = blocks.size() - 1;
+    used = size;
+    return data;
+}
+
+/**
+  @brief
+  Create a reply of a type and attach it to its parent array, if any.
+*/
+static redisReply *arena_reply(const redisReadTask *task, int type) {
+    Redis_reply_arena *arena = static_cast<Redis_reply_arena *>(task->privdata);
+    redisReply *r = static_cast<redisReply *>(arena->alloc(sizeof(redisReply)));
+    if (r == NULL) {
+        return NULL;
+    }
+    memset(r, 0, sizeof(redisReply));
+    r->type = type;
+
+    if (task->parent) {
+        redisReply *parent = static_cast<redisReply *>(task->parent->obj);
+        parent->element[task->idx] = r;
+    }
+    return r;
+}
+
+static void *arena_create_string(const redisReadTask *task, char *str, size_t len) {
+    Redis_reply_arena *arena = static_cast<Redis_reply_arena *>(task->privdata);
+    char *buf = static_cast<char *>(arena->alloc(len + 1));
+    if (buf == NULL) {
+        return NULL;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+
+    redisReply *r = arena_reply(task, task->type);
+    if (r == NULL) {
+        return NULL;
+    }
+    r->str = buf;
+    r->len = len;
+    return r;
+}
+
+#if HIREDIS_MAJOR >= 1
+static void *arena_create_array(const redisReadTask *task, size_t elements) {
+#else
+static void *arena_create_array(const redisReadTask *task, int elements) {
+#endif
+    Redis_reply_arena *arena = static_cast<Redis_reply_arena *>(task->privdata);
+    redisReply *r = arena_reply(task, task->type);
+    if (r == NULL) {
+        return NULL;
+    }
+    if (elements > 0) {
+        r->element = static_cast<redisReply **>(arena->alloc(elements * sizeof(redisReply *)));
+        if (r->element == NULL) {
+            return NULL;
+        }
+    }
+    r->elements = elements;
+    return r;
+}
+
+static void *arena_create_integer(const redisReadTask *task, long long value) {
+    redisReply *r = arena_reply(task, REDIS_REPLY_INTEGER);
+    if (r == NULL) {
+        return NULL;
+    }
+    r->integer = value;
+    return r;
+}
+
+static void *arena_create_nil(const redisReadTask *task) {
+    return arena_reply(task, REDIS_REPLY_NIL);
+}
+
+#if HIREDIS_MAJOR >= 1
+static void *arena_create_double(const redisReadTask *task, double value, char *str,
+                                 size_t len) {
+    redisReply *r = static_cast<redisReply *>(arena_create_string(task, str, len));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->type = REDIS_REPLY_DOUBLE;
+    r->dval = value;
+    return r;
+}
+
+static void *arena_create_bool(const redisReadTask *task, int value) {
+    redisReply *r = arena_reply(task, REDIS_REPLY_BOOL);
+    if (r == NULL) {
+        return NULL;
+    }
+    r->integer = value != 0;
+    return r;
+}
+#endif
+
+/* The memory goes back to the arena as a whole */
+static void arena_free_object(void *) {}
+
+redisReplyObjectFunctions redis_arena_functions = {
+    arena_create_string,
+    arena_create_array,
+    arena_create_integer,
+#if HIREDIS_MAJOR >= 1
+    arena_create_double,
+#endif
+    arena_create_nil,
+#if HIREDIS_MAJOR >= 1
+    arena_create_bool,
+#endif
+    arena_free_object,
+};
@@ -0,0 +1,79 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/** @file redis_arena.h
+
+    @brief
+  Arena the replies of table scans are built in.
+
+    @details
+  hiredis builds every reply as a tree of malloc'ed redisReply objects and
+  strings, i.e. two allocations per row of a scan batch. Replies read with
+  redis_arena_functions are built in a Redis_reply_arena instead: a list of
+  blocks which is rewound, not freed, before the next batch. Once the blocks
+  are large enough for a batch, a scan doesn't allocate memory anymore.
+
+  A reply built in an arena must not be passed to freeReplyObject().
+
+   @see
+  /storage/redis/redis_scripts.cc
+*/
+
+#ifndef REDIS_ARENA_INCLUDED
+#define REDIS_ARENA_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+
+#include "hiredis.h" /* for redis */
+
+/** Size of the blocks of an arena; larger strings get a block of their own */
+#define REDIS_ARENA_BLOCK_SIZE (64 * 1024)
+
+class Redis_reply_arena {
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current;  ///< block allocations are taken from
+    size_t used;     ///< bytes taken from the current block
+
+public:
+    Redis_reply_arena() : current(0), used(0) {}
+    ~Redis_reply_arena();
+
+    /** Allocate size bytes, aligned for any redisReply member. */
+    void *alloc(size_t size);
+
+    /** Give back everything allocated, keeping the blocks for reuse. */
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+};
+
+/** Reply builders allocating from the Redis_reply_arena in the reader's privdata */
+extern redisReplyObjectFunctions redis_arena_functions;
+
+#endif /* REDIS_ARENA_INCLUDED */
@@ -0,0 +1,638 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/**
+  @file redis_codec.cc
+
+  @brief
+  Compiled row codec.
+
+  @details
+  The routines work on a record buffer given by the caller, which may be
+  record[0] or record[1]. Only the generic ones go through Field methods
+  and have to move the field to the buffer.
+*/
+
+#include "redis_codec.h"
+
+#include <string.h>
+#include <atomic>
+
+#include "my_base.h"
+#include "my_bitmap.h"
+#include "my_byteorder.h"
+#include "my_systime.h"
+#include "sql/field.h"
+#include "sql/table.h"
+
+/**
+  @brief
+  Give a field, moved by offset into another record buffer, its default.
+  (Field::set_default() only works on fields in table->record[0].)
+*/
+static void store_default(Field *field, ptrdiff_t offset) {
+    ptrdiff_t to_default = field->table->default_values_offset() - offset;
+
+    field->move_field_offset(offset);
+    memcpy(field->ptr, field->ptr + to_default, field->pack_length());
+    if (field->is_nullable()) {
+        if (field->is_real_null(to_default)) {
+            field->set_null();
+        } else {
+            field->set_notnull();
+        }
+    }
+    field->move_field_offset(-offset);
+}
+
+static uint32 read_length(const uchar *p, uint bytes) {
+    switch (bytes) {
+        case 1:
+            return *p;
+        case 2:
+            return uint2korr(p);
+        case 3:
+            return uint3korr(p);
+        default:
+            return uint4korr(p);
+    }
+}
+
+/*
+  Fixed width columns: the bytes of the record, N known at compile time
+  for the common widths.
+*/
+template <uint N>
+static void encode_fixed(const Redis_column &col, Field *, const uchar *record,
+                         std::string *row, String *) {
+    row->append(reinterpret_cast<const char *>(record + col.offset), N ? N : col.length);
+}
+
+template <uint N>
+static const char *decode_fixed(const Redis_column &col, Field *, uchar *record,
+                                const char *p, const char *end) {
+    size_t length = N ? N : col.length;
+    if ((size_t)(end - p) < length) {
+        return NULL;
+    }
+    memcpy(record + col.offset, p, length);
+    return p + length;
+}
+
+/*
+  VARCHAR: the length bytes and the used part of the column, as in the
+  record.
+*/
+template <uint LENGTH_BYTES>
+static void encode_varstring(const Redis_column &col, Field *, const uchar *record,
+                             std::string *row, String *) {
+    const uchar *value = record + col.offset;
+    row->append(reinterpret_cast<const char *>(value),
+                LENGTH_BYTES + read_length(value, LENGTH_BYTES));
+}
+
+template <uint LENGTH_BYTES>
+static const char *decode_varstring(const Redis_column &col, Field *, uchar *record,
+                                    const char *p, const char *end) {
+    if ((size_t)(end - p) < LENGTH_BYTES) {
+        return NULL;
+    }
+    size_t length = LENGTH_BYTES + read_length(reinterpret_cast<const uchar *>(p), LENGTH_BYTES);
+    if (length > col.length || (size_t)(end - p) < length) {
+        return NULL;
+    }
+    memcpy(record + col.offset, p, length);
+    return p + length;
+}
+
+/**
+  @brief
+  Point a BLOB column of record to data, as decode_blob() does.
+*/
+static void store_blob(const Redis_column &col, uchar *record, const char *data,
+                       uint32 length) {
+    uchar *value = record + col.offset;
+    switch (col.length_bytes) {
+        case 1:
+            *value = (uchar)length;
+            break;
+        case 2:
+            int2store(value, length);
+            break;
+        case 3:
+            int3store(value, length);
+            break;
+        default:
+            int4store(value, length);
+            break;
+    }
+    memcpy(value + col.length_bytes, &data, sizeof(data));
+}
+
+/*
+  BLOB, TEXT, JSON, GEOMETRY: 4 bytes length and the data the record
+  points to. Decoding points the record to the data in the row, as
+  Field_blob::set_ptr() does, so the row must outlive the record.
+*/
+template <uint PACK_LENGTH>
+static void encode_blob(const Redis_column &col, Field *, const uchar *record,
+                        std::string *row, String *) {
+    const uchar *value = record + col.offset;
+    uint32 length = read_length(value, PACK_LENGTH);
+    const char *data;
+    memcpy(&data, value + PACK_LENGTH, sizeof(data));
+
+    char prefix[4];
+    int4store(prefix, length);
+    row->append(prefix, sizeof(prefix));
+    row->append(data, length);
+}
+
+template <uint PACK_LENGTH>
+static const char *decode_blob(const Redis_column &col, Field *, uchar *record,
+                               const char *p, const char *end) {
+    if (end - p < 4) {
+        return NULL;
+    }
+    uint32 length = uint4korr(p);
+    p += 4;
+    if ((size_t)(end - p) < length || (PACK_LENGTH < 4 && length >> (8 * PACK_LENGTH))) {
+        return NULL;
+    }
+
+    store_blob(col, record, p, length);
+    return p + length;
+}
+
+/*
+  Anything else (BIT, whose high bits live in the null bytes): the string
+  value with a 4 bytes length.
+*/
+static void encode_generic(const Redis_column &, Field *field, const uchar *record,
+                           std::string *row, String *scratch) {
+    ptrdiff_t offset = record - field->table->record[0];
+    field->move_field_offset(offset);
+    String *value = field->val_str(scratch, scratch);
+    field->move_field_offset(-offset);
+
+    char prefix[4];
+    int4store(prefix, (uint32)value->length());
+    row->append(prefix, sizeof(prefix));
+    row->append(value->ptr(), value->length());
+}
+
+static const char *decode_generic(const Redis_column &, Field *field, uchar *record,
+                                  const char *p, const char *end) {
+    if (end - p < 4) {
+        return NULL;
+    }
+    uint32 length = uint4korr(p);
+    p += 4;
+    if ((size_t)(end - p) < length) {
+        return NULL;
+    }
+
+    ptrdiff_t offset = record - field->table->record[0];
+    field->move_field_offset(offset);
+    field->store(p, length, &my_charset_bin, CHECK_FIELD_IGNORE);
+    field->move_field_offset(-offset);
+    return p + length;
+}
+
+/**
+  @brief
+  New id of an out-of-line value: the time this server started to hand out
+  ids, which tells servers sharing the Redis keys apart, and a counter.
+*/
+static std::string new_blob_id() {
+    static const std::string prefix = std::to_string(my_micro_time()) + ".";
+    static std::atomic<ulonglong> counter(0);
+    return prefix + std::to_string(++counter);
+}
+
+static bool is_blob_ref(const char *p, const char *end) {
+    return end - p >= REDIS_BLOB_REF_HEADER && uint4korr(p) == REDIS_BLOB_REF_MARK;
+}
+
+static size_t blob_ref_length(const char *ref) {
+    return REDIS_BLOB_REF_HEADER + (uchar)ref[REDIS_BLOB_REF_HEADER - 1];
+}
+
+/**
+  @brief
+  Position after the value of a column at p, NULL if the row is truncated.
+*/
+static const char *skip_value(const Redis_column &col, const char *p, const char *end) {
+    size_t length;
+    switch (col.storage) {
+        case REDIS_STORAGE_FIXED:
+            length = col.length;
+            break;
+        case REDIS_STORAGE_VARSTRING:
+            if ((size_t)(end - p) < col.length_bytes) {
+                return NULL;
+            }
+            length = col.length_bytes +
+                     read_length(reinterpret_cast<const uchar *>(p), col.length_bytes);
+            break;
+        default:
+            if (is_blob_ref(p, end)) {
+                length = blob_ref_length(p);
+            } else if (end - p < 4) {
+                return NULL;
+            } else {
+                length = 4 + (size_t)uint4korr(p);
+            }
+            break;
+    }
+    return (size_t)(end - p) < length ? NULL : p + length;
+}
+
+void Redis_row_codec::compile(const TABLE *table) {
+    columns.clear();
+    fixed_length = REDIS_ROW_MAGIC_LENGTH + 2;
+    has_blobs = false;
+
+    for (Field **f = table->field; *f; f++) {
+        Field *field = *f;
+        Redis_column col;
+        col.storage = REDIS_STORAGE_FIXED;
+        col.offset = (uint)(field->ptr - table->record[0]);
+        col.length = field->pack_length();
+        col.length_bytes = 0;
+        col.null_offset = field->is_nullable() ? field->null_offset() : 0;
+        col.null_bit = field->is_nullable() ? field->null_bit : 0;
+
+        switch (field->real_type()) {
+            case MYSQL_TYPE_VARCHAR:
+                col.storage = REDIS_STORAGE_VARSTRING;
+                col.length_bytes = static_cast<Field_varstring *>(field)->length_bytes;
+                if (col.length_bytes == 1) {
+                    col.encode = encode_varstring<1>;
+                    col.decode = decode_varstring<1>;
+                } else {
+                    col.encode = encode_varstring<2>;
+                    col.decode = decode_varstring<2>;
+                }
+                fixed_length += col.length_bytes;
+                break;
+            case MYSQL_TYPE_TINY_BLOB:
+            case MYSQL_TYPE_BLOB:
+            case MYSQL_TYPE_MEDIUM_BLOB:
+            case MYSQL_TYPE_LONG_BLOB:
+            case MYSQL_TYPE_JSON:
+            case MYSQL_TYPE_GEOMETRY:
+                col.storage = REDIS_STORAGE_BLOB;
+                col.length_bytes = static_cast<Field_blob *>(field)->pack_length_no_ptr();
+                has_blobs = true;
+                switch (col.length_bytes) {
+                    case 1:
+                        col.encode = encode_blob<1>;
+                        col.decode = decode_blob<1>;
+                        break;
+                    case 2:
+                        col.encode = encode_blob<2>;
+                        col.decode = decode_blob<2>;
+                        break;
+                    case 3:
+                        col.encode = encode_blob<3>;
+                        col.decode = decode_blob<3>;
+                        break;
+                    default:
+                        col.encode = encode_blob<4>;
+                        col.decode = decode_blob<4>;
+                        break;
+                }
+                fixed_length += 4;
+                break;
+            case MYSQL_TYPE_BIT:
+                col.storage = REDIS_STORAGE_GENERIC;
+                col.encode = encode_generic;
+                col.decode = decode_generic;
+                fixed_length += 4 + col.length;
+                break;
+            default:
+                switch (col.length) {
+                    case 1:
+                        col.encode = encode_fixed<1>;
+                        col.decode = decode_fixed<1>;
+                        break;
+                    case 2:
+                        col.encode = encode_fixed<2>;
+                        col.decode = decode_fixed<2>;
+                        break;
+                    case 3:
+                        col.encode = encode_fixed<3>;
+                        col.decode = decode_fixed<3>;
+                        break;
+                    case 4:
+                        col.encode = encode_fixed<4>;
+                        col.decode = decode_fixed<4>;
+                        break;
+                    case 5:
+                        col.encode = encode_fixed<5>;
+                        col.decode = decode_fixed<5>;
+                        break;
+                    case 8:
+                        col.encode = encode_fixed<8>;
+                        col.decode = decode_fixed<8>;
+                        break;
+                    default:
+                        col.encode = encode_fixed<0>;
+                        col.decode = decode_fixed<0>;
+                        break;
+                }
+                fixed_length += col.length;
+                break;
+        }
+        columns.push_back(col);
+    }
+    bitmap_bytes = (columns.size() + 7) / 8;
+    fixed_length += bitmap_bytes;
+}
+
+std::string Redis_row_codec::layout(size_t n) const {
+    std::string words;
+    for (size_t i = 0; i < n && i < columns.size(); i++) {
+        const Redis_column &col = columns[i];
+        if (i > 0) {
+            words += ' ';
+        }
+        switch (col.storage) {
+            case REDIS_STORAGE_FIXED:
+                words += 'f' + std::to_string(col.length);
+                break;
+            case REDIS_STORAGE_VARSTRING:
+                words += 'v' + std::to_string(col.length_bytes);
+                break;
+            case REDIS_STORAGE_BLOB:
+                words += 'b';
+                break;
+            default:
+                words += 'g';
+                break;
+        }
+    }
+    return words;
+}
+
+/**
+  @brief
+  Bytes in front of the column count of a row in the binary format, 0 if
+  the row is in the text format.
+*/
+static size_t header_length(const char *row, size_t length) {
+    if (length >= REDIS_ROW_MAGIC_LENGTH + 2 &&
+        memcmp(row, REDIS_ROW_MAGIC, REDIS_ROW_MAGIC_LENGTH) == 0) {
+        return REDIS_ROW_MAGIC_LENGTH;
+    }
+    if (length >= REDIS_ROW_EXPIRY_HEADER + 2 &&
+        memcmp(row, REDIS_ROW_MAGIC_EXPIRY, REDIS_ROW_MAGIC_LENGTH) == 0) {
+        return REDIS_ROW_EXPIRY_HEADER;
+    }
+    if (length >= REDIS_ROW_EXPIRY_HEADER + 4 &&
+        memcmp(row, REDIS_ROW_MAGIC_EXPIRY_KEY, REDIS_ROW_MAGIC_LENGTH) == 0) {
+        size_t header = REDIS_ROW_EXPIRY_HEADER + 2 + uint2korr(row + REDIS_ROW_EXPIRY_HEADER);
+        return length >= header + 2 ? header : 0;
+    }
+    return 0;
+}
+
+/**
+  @brief
+  Find the references to out-of-line values in a row: refs[i] is the one
+  of column i, or NULL.
+
+  @return false if the row has none.
+*/
+bool Redis_row_codec::find_refs(const char *row, size_t length,
+                                std::vector<const char *> *refs) const {
+    size_t header = header_length(row, length);
+    if (!has_blobs || header == 0) {
+        return false;
+    }
+    const char *end = row + length;
+    size_t count = uint2korr(row + header);
+    const char *bitmap = row + header + 2;
+    const char *p = bitmap + (count + 7) / 8;
+    bool found = false;
+
+    refs->assign(columns.size(), NULL);
+    for (size_t i = 0; i < columns.size() && i < count && p && p <= end; i++) {
+        if (bitmap[i / 8] & (1 << (i & 7))) {
+            continue;
+        }
+        if (columns[i].storage == REDIS_STORAGE_BLOB && is_blob_ref(p, end)) {
+            (*refs)[i] = p;
+            found = true;
+        }
+        p = skip_value(columns[i], p, end);
+    }
+    return found;
+}
+
+void Redis_row_codec::blob_ids(const char *row, size_t length, const MY_BITMAP *cols,
+                               Redis_args *ids) const {
+    std::vector<const char *> refs;
+    if (!find_refs(row, length, &refs)) {
+        return;
+    }
+    for (size_t i = 0; i < refs.size(); i++) {
+        if (refs[i] && (cols == NULL || bitmap_is_set(cols, (uint)i))) {
+            ids->emplace_back(refs[i] + REDIS_BLOB_REF_HEADER,
+                              (uchar)refs[i][REDIS_BLOB_REF_HEADER - 1]);
+        }
+    }
+}
+
+void Redis_row_codec::set_expiry(std::string *row, ulonglong at, const std::string *key) {
+    std::string header(key ? REDIS_ROW_MAGIC_EXPIRY_KEY : REDIS_ROW_MAGIC_EXPIRY,
+                       REDIS_ROW_MAGIC_LENGTH);
+    char time[8];
+    int8store(time, at);
+    header.append(time, sizeof(time));
+    if (key) {
+        char key_length[2];
+        int2store(key_length, (uint16)key->length());
+        header.append(key_length, sizeof(key_length));
+        header.append(*key);
+    }
+    row->replace(0, REDIS_ROW_MAGIC_LENGTH, header);
+}
+
+ulonglong Redis_row_codec::expiry(const char *row, size_t length) {
+    if (header_length(row, length) < REDIS_ROW_EXPIRY_HEADER) {
+        return 0;
+    }
+    return uint8korr(row + REDIS_ROW_MAGIC_LENGTH);
+}
+
+bool Redis_blob_cursor::next_value(const char **data, size_t *length) {
+    if (values == NULL || next >= values->elements) {
+        return false;
+    }
+    const redisReply *value = values->element[next++];
+    if (value->type != REDIS_REPLY_STRING) {
+        return false;
+    }
+    *data = value->str;
+    *length = value->len;
+    return true;
+}
+
+void Redis_row_codec::encode(const TABLE *table, const uchar *record, std::string *row,
+                             String *scratch, Redis_blob_writes *blobs) const {
+    std::vector<const char *> old_refs;
+    bool has_old_refs = blobs && blobs->old_row &&
+                        find_refs(blobs->old_row->data(), blobs->old_row->length(), &old_refs);
+    char count[2];
+    int2store(count, (uint16)columns.size());
+
+    row->clear();
+    row->reserve(fixed_length);
+    row->append(REDIS_ROW_MAGIC, REDIS_ROW_MAGIC_LENGTH);
+    row->append(count, sizeof(count));
+    size_t bitmap = row->length();
+    row->append(bitmap_bytes, '\0');
+
+    for (size_t i = 0; i < columns.size(); i++) {
+        const Redis_column &col = columns[i];
+        if (record[col.null_offset] & col.null_bit) {
+            (*row)[bitmap + i / 8] |= (char)(1 << (i & 7));
+            continue;
+        }
+        if (col.storage == REDIS_STORAGE_BLOB && blobs) {
+            const char *old_ref = has_old_refs ? old_refs[i] : NULL;
+            if (old_ref && blobs->changed && !bitmap_is_set(blobs->changed, (uint)i)) {
+                row->append(old_ref, blob_ref_length(old_ref));
+                old_refs[i] = NULL;  // kept
+                continue;
+            }
+            const uchar *value = record + col.offset;
+            uint32 length = read_length(value, col.length_bytes);
+            if (blobs->limit && length > blobs->limit) {
+                const char *data;
+                memcpy(&data, value + col.length_bytes, sizeof(data));
+                std::string id = new_blob_id();
+                char header[REDIS_BLOB_REF_HEADER];
+                int4store(header, REDIS_BLOB_REF_MARK);
+                int4store(header + 4, length);
+                header[REDIS_BLOB_REF_HEADER - 1] = (char)id.length();
+                row->append(header, sizeof(header));
+                row->append(id);
+                blobs->set.push_back(id);
+                blobs->set.emplace_back(data, length);
+                continue;
+            }
+        }
+        col.encode(col, table->field[i], record, row, scratch);
+    }
+
+    // references of the old row which weren't kept are garbage now
+    for (size_t i = 0; has_old_refs && i < old_refs.size(); i++) {
+        if (old_refs[i]) {
+            blobs->del.emplace_back(old_refs[i] + REDIS_BLOB_REF_HEADER,
+                                    (uchar)old_refs[i][REDIS_BLOB_REF_HEADER - 1]);
+        }
+    }
+}
+
+/**
+  @brief
+  Decode a row of the former text format: every value followed by ',',
+  NULL as an empty value.
+*/
+static void decode_text(const TABLE *table, uchar *record, const char *row, size_t length) {
+    const char *p = row;
+    const char *end = row + length;
+    ptrdiff_t offset = record - table->record[0];
+
+    for (Field **field = table->field; *field; field++) {
+        if (p >= end) {
+            store_default(*field, offset);
+            continue;
+        }
+        const char *sep = static_cast<const char *>(memchr(p, ',', end - p));
+        if (sep == NULL) {
+            sep = end;
+        }
+        (*field)->move_field_offset(offset);
+        // no value means NULL
+        if (sep == p) {
+            (*field)->set_null();
+        } else {
+            (*field)->set_notnull();
+            (*field)->store(p, sep - p, &my_charset_bin, CHECK_FIELD_IGNORE);
+        }
+        (*field)->move_field_offset(-offset);
+        p = (sep < end) ? sep + 1 : end;
+    }
+}
+
+int Redis_row_codec::decode(const TABLE *table, uchar *record, const char *row,
+                            size_t length, Redis_blob_cursor *blobs) const {
+    memset(record, 0, table->s->null_bytes);
+    size_t header = header_length(row, length);
+    if (header == 0) {
+        decode_text(table, record, row, length);
+        return 0;
+    }
+
+    const char *end = row + length;
+    size_t count = uint2korr(row + header);
+    const char *bitmap = row + header + 2;
+    const char *p = bitmap + (count + 7) / 8;
+    if (p > end) {
+        return HA_ERR_CRASHED;
+    }
+
+    for (size_t i = 0; i < columns.size(); i++) {
+        const Redis_column &col = columns[i];
+        Field *field = table->field[i];
+        if (i >= count) {
+            // added to the table after the row was written
+            store_default(field, record - table->record[0]);
+            continue;
+        }
+        if (bitmap[i / 8] & (1 << (i & 7))) {
+            record[col.null_offset] |= col.null_bit;
+            continue;
+        }
+        if (col.storage == REDIS_STORAGE_BLOB && is_blob_ref(p, end)) {
+            const char *data = "";
+            size_t data_length = 0;
+            // values of columns the statement doesn't read aren't fetched
+            if (bitmap_is_set(table->read_set, (uint)i) &&
+                (blobs == NULL || !blobs->next_value(&data, &data_length))) {
+                return HA_ERR_RECORD_CHANGED;
+            }
+            store_blob(col, record, data, (uint32)data_length);
+            p = skip_value(col, p, end);
+        } else {
+            p = col.decode(col, field, record, p, end);
+        }
+        if (p == NULL) {
+            return HA_ERR_CRASHED;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/** @file redis_codec.h
+
+    @brief
+  Row codec of the redis storage engine.
+
+    @details
+  A row is stored as
+
+    REDIS_ROW_MAGIC, column count (2 bytes), null bitmap, values
+
+  where the null bitmap has one bit per column and a NULL column has no
+  value. Values are copied from the record buffer: fixed width columns
+  (integers, temporal types, DECIMAL, CHAR, ...) as their pack_length()
+  bytes, VARCHAR as its length bytes and data, BLOB/TEXT/JSON/GEOMETRY as a
+  4 byte length and the data. Other columns (BIT) are stored as their
+  string value with a 4 byte length.
+
+  A BLOB/TEXT/JSON/GEOMETRY value longer than the limit given to encode()
+  is stored out of line, in the hash <table>:blobs, and the row holds a
+  reference instead:
+
+    0xffffffff, length of the value (4 bytes), id length (1 byte), id
+
+  Such values are read only for the columns in the read_set, from a
+  Redis_blob_cursor over the values fetched for a row or a batch of rows.
+
+  A row of a table whose rows expire starts with REDIS_ROW_MAGIC_EXPIRY
+  and the time it expires at, in milliseconds since the epoch (8 bytes,
+  0 for never), instead of REDIS_ROW_MAGIC. The write scripts read it too
+  (see ROW_EXPIRY in redis_scripts.cc). A row of such a list table with
+  a unique index starts with REDIS_ROW_MAGIC_EXPIRY_KEY instead, and the
+  time is followed by the row's index key (2 byte length and the key,
+  empty for a key with a NULL part), so that the scripts can delete the
+  index entry of a row they find expired (see RECLAIM).
+
+  The column count is the schema version of the row: columns added by an
+  instant ADD COLUMN after the row was written get their default.
+  Rows written in the former comma separated text format are still read.
+
+  The codec of a table is compiled once per TABLE_SHARE into a flat array
+  of columns with an encode and a decode routine each, instantiated per
+  storage class and width.
+
+   @see
+  /storage/redis/ha_redis.cc
+*/
+
+#ifndef REDIS_CODEC_INCLUDED
+#define REDIS_CODEC_INCLUDED
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "my_inttypes.h"
+#include "redis_scripts.h"
+
+class Field;
+class String;
+struct MY_BITMAP;
+struct TABLE;
+
+/** First bytes of a row in the binary format, never produced by the text format */
+#define REDIS_ROW_MAGIC "\xff\x01"
+#define REDIS_ROW_MAGIC_LENGTH 2
+/** First bytes of a row which carries the time it expires at */
+#define REDIS_ROW_MAGIC_EXPIRY "\xff\x02"
+/** Bytes of REDIS_ROW_MAGIC_EXPIRY and the expiry time */
+#define REDIS_ROW_EXPIRY_HEADER (REDIS_ROW_MAGIC_LENGTH + 8)
+/** First bytes of a row which carries the time it expires at and its index key */
+#define REDIS_ROW_MAGIC_EXPIRY_KEY "\xff\x03"
+
+/** Length prefix marking a reference to an out-of-line value */
+#define REDIS_BLOB_REF_MARK 0xffffffffU
+/** Bytes of a reference before the id */
+#define REDIS_BLOB_REF_HEADER 9
+
+struct Redis_column;
+
+/** Append the value of a column of record to a row */
+typedef void (*redis_encode_func)(const Redis_column &col, Field *field,
+                                  const uchar *record, std::string *row,
+                                  String *scratch);
+
+/**
+  Store the value at p into the column of record.
+  @return the position after the value, NULL if the row is truncated.
+*/
+typedef const char *(*redis_decode_func)(const Redis_column &col, Field *field,
+                                         uchar *record, const char *p,
+                                         const char *end);
+
+/** How a column is laid out in a row */
+enum redis_column_storage {
+    REDIS_STORAGE_FIXED,      ///< pack_length() bytes
+    REDIS_STORAGE_VARSTRING,  ///< length bytes and data
+    REDIS_STORAGE_BLOB,       ///< 4 bytes length and data, or a reference
+    REDIS_STORAGE_GENERIC     ///< 4 bytes length and the string value
+};
+
+/** One column of a compiled codec */
+struct Redis_column {
+    redis_column_storage storage;
+    uint offset;         ///< offset of the value in the record
+    uint length;         ///< pack_length() of the column
+    uint length_bytes;   ///< bytes of the length prefix (VARCHAR, BLOB)
+    uint null_offset;    ///< offset of the null byte in the record
+    uchar null_bit;      ///< null bit, 0 if the column is NOT NULL
+    redis_encode_func encode;
+    redis_decode_func decode;
+};
+
+/**
+  Out-of-line values written along with a row. The limit and the row
+  replaced are given by the caller, the values to store and the ids to
+  delete are filled in by Redis_row_codec::encode().
+*/
+struct Redis_blob_writes {
+    size_t limit;                 ///< longer values go out of line, 0 for none
+    const std::string *old_row;   ///< row replaced by an update, or NULL
+    const MY_BITMAP *changed;     ///< columns the update writes
+    Redis_args set;               ///< id, value pairs to store
+    Redis_args del;               ///< ids no longer referenced
+
+    Redis_blob_writes(size_t limit_arg, const std::string *old_row_arg = NULL,
+                      const MY_BITMAP *changed_arg = NULL)
+        : limit(limit_arg), old_row(old_row_arg), changed(changed_arg) {}
+};
+
+/** Out-of-line values fetched with HMGET, in the order of their ids */
+class Redis_blob_cursor {
+    const redisReply *values;
+    size_t next;
+
+public:
+    Redis_blob_cursor() : values(NULL), next(0) {}
+
+    void reset(const redisReply *reply) {
+        values = reply;
+        next = 0;
+    }
+
+    /** Take the next value. @return false if it doesn't exist (anymore). */
+    bool next_value(const char **data, size_t *length);
+};
+
+class Redis_row_codec {
+    std::vector<Redis_column> columns;
+    size_t bitmap_bytes;   ///< bytes of the null bitmap of a full row
+    size_t fixed_length;   ///< size of a row without variable length data
+    bool has_blobs;        ///< some column may be stored out of line
+
+    bool find_refs(const char *row, size_t length,
+                   std::vector<const char *> *refs) const;
+
+public:
+    Redis_row_codec() : bitmap_bytes(0), fixed_length(0), has_blobs(false) {}
+
+    /** Build the plan for the fields of a table. */
+    void compile(const TABLE *table);
+
+    /**
+      Encode record (record[0] or another record buffer of table).
+      With blobs, long values are stored out of line. Columns an update
+      doesn't write keep the reference of the old row: their value may not
+      have been read.
+    */
+    void encode(const TABLE *table, const uchar *record, std::string *row,
+                String *scratch, Redis_blob_writes *blobs = NULL) const;
+
+    /**
+      Decode a row into record. Columns missing in the row get their default.
+      BLOB columns point into row, which must stay valid while the record
+      is used. Out-of-line values of the columns in the read_set are taken
+      from blobs, the others are left empty.
+
+      @return 0, HA_ERR_CRASHED if the row is corrupt, or
+              HA_ERR_RECORD_CHANGED if an out-of-line value is gone.
+    */
+    int decode(const TABLE *table, uchar *record, const char *row,
+               size_t length, Redis_blob_cursor *blobs = NULL) const;
+
+    /**
+      Append the ids of the out-of-line values of a row to ids, of the
+      columns in columns or of all columns if it is NULL.
+    */
+    void blob_ids(const char *row, size_t length, const MY_BITMAP *columns,
+                  Redis_args *ids) const;
+
+    /**
+      The layout of the first n columns of a row as the scan scripts walk
+      it (see ROW_FILTER in redis_scripts.cc), a word per column.
+    */
+    std::string layout(size_t n) const;
+
+    /**
+      Make an encoded row expire at a time (ms since the epoch, 0 for
+      never), carrying the index key key unless it is NULL.
+    */
+    static void set_expiry(std::string *row, ulonglong at, const std::string *key = NULL);
+
+    /** Time a row expires at, 0 if it doesn't expire. */
+    static ulonglong expiry(const char *row, size_t length);
+};
+
+#endif /* REDIS_CODEC_INCLUDED */
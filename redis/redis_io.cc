@@ -0,0 +1,244 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/**
+  @file redis_io.cc
+
+  @brief
+  Command deadlines and hedged reads.
+
+  @details
+  The latency of point reads is kept in a histogram with four buckets per
+  power of two microseconds, so a percentile is known within 25%. The
+  counts are halved every REDIS_LATENCY_DECAY reads, which lets the
+  percentile follow a change of the workload.
+*/
+
+#include "redis_io.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+#include "my_dbug.h"
+#include "my_systime.h"
+
+#define REDIS_LATENCY_BUCKETS 160
+#define REDIS_LATENCY_DECAY 8192
+/** Reads recorded before a percentile is trusted */
+#define REDIS_LATENCY_MIN_SAMPLES 100
+
+ulong redis_command_timeout = 0;
+
+Redis_io_status redis_io_status;
+
+static std::atomic<ulong> latency_buckets[REDIS_LATENCY_BUCKETS];
+static std::atomic<ulong> latency_samples(0);
+
+redisContext *redis_connect_to(const char *host, int port) {
+    redisContext *c = redisConnect(host, port);
+    if (c != NULL && !c->err) {
+        redis_apply_timeout(c);
+    }
+    return c;
+}
+
+void redis_apply_timeout(redisContext *c) {
+    struct timeval tv;
+    tv.tv_sec = redis_command_timeout / 1000;
+    tv.tv_usec = (redis_command_timeout % 1000) * 1000;
+    redisSetTimeout(c, tv);
+}
+
+int redis_reconnect(redisContext *c) {
+    if (redisReconnect(c) != REDIS_OK) {
+        return REDIS_ERR;
+    }
+    redis_apply_timeout(c);
+    return REDIS_OK;
+}
+
+bool redis_timed_out(const redisContext *c) {
+#ifdef REDIS_ERR_TIMEOUT
+    if (c->err == REDIS_ERR_TIMEOUT) {
+        return true;
+    }
+#endif
+    // older hiredis report the expired SO_RCVTIMEO as an I/O error. errno
+    // may have changed since, but the context keeps its text
+    if (c->err != REDIS_ERR_IO) {
+        return false;
+    }
+    return strcmp(c->errstr, strerror(EAGAIN)) == 0 ||
+           strcmp(c->errstr, strerror(EWOULDBLOCK)) == 0 ||
+           strcmp(c->errstr, strerror(ETIMEDOUT)) == 0;
+}
+
+/**
+  @brief
+  Histogram bucket of a latency: values below 8 have their own bucket,
+  above that there are four buckets per power of two.
+*/
+static uint latency_bucket(ulonglong usec) {
+    uint octave = 0;
+    while (usec >= 8) {
+        usec >>= 1;
+        octave++;
+    }
+    uint bucket = octave * 4 + (uint)usec;
+    return bucket < REDIS_LATENCY_BUCKETS ? bucket : REDIS_LATENCY_BUCKETS - 1;
+}
+
+/**
+  @brief
+  Upper bound (exclusive) of the latencies in a bucket.
+*/
+static ulonglong latency_bucket_bound(uint bucket) {
+    if (bucket < 8) {
+        return bucket + 1;
+    }
+    uint octave = (bucket - 4) / 4;
+    return (ulonglong)(bucket - octave * 4 + 1) << octave;
+}
+
+void redis_record_latency(ulonglong usec) {
+    latency_buckets[latency_bucket(usec)]++;
+    if (++latency_samples % REDIS_LATENCY_DECAY == 0) {
+        // racing increments may be lost, which doesn't matter for an estimate
+        for (uint i = 0; i < REDIS_LATENCY_BUCKETS; i++) {
+            latency_buckets[i].store(latency_buckets[i].load() / 2);
+        }
+    }
+}
+
+ulonglong redis_latency_percentile(uint percentile) {
+    if (percentile == 0) {
+        return 0;
+    }
+    ulong counts[REDIS_LATENCY_BUCKETS];
+    ulonglong total = 0;
+    for (uint i = 0; i < REDIS_LATENCY_BUCKETS; i++) {
+        counts[i] = latency_buckets[i].load();
+        total += counts[i];
+    }
+    if (total < REDIS_LATENCY_MIN_SAMPLES) {
+        return 0;
+    }
+
+    ulonglong target = (total * percentile + 99) / 100;
+    ulonglong seen = 0;
+    for (uint i = 0; i < REDIS_LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= target) {
+            return latency_bucket_bound(i);
+        }
+    }
+    return latency_bucket_bound(REDIS_LATENCY_BUCKETS - 1);
+}
+
+/**
+  @brief
+  Queue a command and write it out, without waiting for the reply.
+*/
+static bool send_args(redisContext *c, const Redis_args &args) {
+    if (redis_append_args(c, args) != REDIS_OK) {
+        return false;
+    }
+    int done = 0;
+    while (!done) {
+        if (redisBufferWrite(c, &done) != REDIS_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+redisReply *redis_race(redisContext *c, redisContext *alt, const Redis_args &args,
+                       ulonglong delay, bool *alt_won) {
+    DBUG_ENTER("redis_race");
+    redisContext *conns[2] = {c, alt};
+    bool sent[2] = {false, false};
+    bool live[2] = {false, false};
+    void *reply = NULL;
+    int winner = -1;
+
+    ulonglong start = my_micro_time();
+    ulonglong deadline = redis_command_timeout ? start + redis_command_timeout * 1000 : 0;
+    ulonglong hedge_at = start + delay;
+
+    *alt_won = false;
+    sent[0] = live[0] = send_args(c, args);
+    while (winner < 0) {
+        ulonglong now = my_micro_time();
+        if (!sent[1] && (now >= hedge_at || !live[0])) {
+            // no answer in time (or the first endpoint failed): ask the other one
+            sent[1] = live[1] = send_args(alt, args);
+            redis_io_status.hedged_reads++;
+        }
+        if (!live[0] && !live[1]) {
+            break;
+        }
+        if (deadline && now >= deadline) {
+            redis_io_status.deadline_expirations++;
+            break;
+        }
+
+        ulonglong wake = deadline;
+        if (!sent[1] && (!wake || hedge_at < wake)) {
+            wake = hedge_at;
+        }
+        int timeout = wake ? (int)((wake - now + 999) / 1000) : -1;
+
+        struct pollfd fds[2];
+        for (int i = 0; i < 2; i++) {
+            fds[i].fd = live[i] ? conns[i]->fd : -1;  // poll() skips fd -1
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < 2 && winner < 0; i++) {
+            if (!live[i] || !fds[i].revents) {
+                continue;
+            }
+            if (redisBufferRead(conns[i]) != REDIS_OK ||
+                redisGetReplyFromReader(conns[i], &reply) != REDIS_OK) {
+                live[i] = false;
+            } else if (reply) {
+                winner = i;
+            }
+        }
+    }
+
+    // a connection still waiting for its reply would read it as the next one
+    for (int i = 0; i < 2; i++) {
+        if (sent[i] && i != winner) {
+            redis_reconnect(conns[i]);
+        }
+    }
+    if (winner == 1) {
+        redis_io_status.hedge_wins++;
+        *alt_won = true;
+    }
+    DBUG_RETURN((redisReply *)reply);
+}
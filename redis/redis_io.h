@@ -0,0 +1,98 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/** @file redis_io.h
+
+    @brief
+  Command deadlines and hedged reads of the redis storage engine.
+
+    @details
+  Every connection gets the socket timeout redis_command_timeout, so a
+  command which isn't answered in time fails instead of stalling the
+  statement. The connection is reconnected afterwards, as the late reply
+  would otherwise be taken for the answer to the next command.
+
+  A hedged read is sent to one endpoint and, if it isn't answered within a
+  delay, to a second one; the first answer wins and the other connection is
+  reconnected to drop its reply.
+
+   @see
+  /storage/redis/ha_redis.cc
+*/
+
+#ifndef REDIS_IO_INCLUDED
+#define REDIS_IO_INCLUDED
+
+#include <atomic>
+
+#include "my_inttypes.h"
+
+#include "hiredis.h" /* for redis */
+#include "redis_scripts.h"
+
+/** Deadline of a command in milliseconds, 0 for none */
+extern ulong redis_command_timeout;
+
+/** Counters shown as status variables */
+struct Redis_io_status {
+    std::atomic<ulong> deadline_expirations;  ///< commands not answered in time
+    std::atomic<ulong> hedged_reads;          ///< reads sent to a second endpoint
+    std::atomic<ulong> hedge_wins;            ///< hedged reads the second endpoint answered first
+};
+
+extern Redis_io_status redis_io_status;
+
+/** Connect to an endpoint and apply the command deadline. */
+redisContext *redis_connect_to(const char *host, int port);
+
+/** Apply the current command deadline to a connection. */
+void redis_apply_timeout(redisContext *c);
+
+/** Reconnect a connection which failed or has a reply in flight. */
+int redis_reconnect(redisContext *c);
+
+/** Whether the last command on c failed because its deadline passed. */
+bool redis_timed_out(const redisContext *c);
+
+/** Record the latency of a point read, in microseconds. */
+void redis_record_latency(ulonglong usec);
+
+/**
+  Latency of point reads at a percentile, in microseconds.
+
+  @return 0 if percentile is 0 or too few reads were recorded yet.
+*/
+ulonglong redis_latency_percentile(uint percentile);
+
+/**
+  Send a command to c and, if no answer came after delay microseconds, to
+  alt as well. Both connections must have no command in flight.
+
+  @param[out] alt_won  set if the answer is the one of alt
+
+  @return the first answer, or NULL if none came before the deadline or
+  both connections failed.
+*/
+redisReply *redis_race(redisContext *c, redisContext *alt, const Redis_args &args,
+                       ulonglong delay, bool *alt_won);
+
+#endif /* REDIS_IO_INCLUDED */
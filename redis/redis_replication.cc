@@ -0,0 +1,189 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/**
+  @file redis_replication.cc
+
+  @brief
+  Replica endpoints and the replication lag monitor.
+
+  @details
+  A replica is identified in INFO replication by the address it announces
+  (replica-announce-ip / replica-announce-port), which is what
+  redis_replicas must list. A replica which isn't listed there, or isn't
+  online, is never read from.
+*/
+
+#include "redis_replication.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+
+#include "my_dbug.h"
+#include "my_systime.h"
+
+static std::vector<Redis_endpoint> redis_replicas;
+
+/* Result of the last INFO replication, protected by monitor_lock */
+static std::mutex monitor_lock;
+static ulonglong checked_at = 0;          ///< my_micro_time() when INFO was sent
+static longlong primary_offset = 0;       ///< master_repl_offset of the primary
+static std::vector<longlong> replica_offsets;  ///< -1 if not online
+
+static std::atomic<ulong> next_replica(0);
+
+bool redis_replicas_init(const char *list) {
+    redis_replicas.clear();
+    if (list == NULL) {
+        return true;
+    }
+
+    std::string s = list;
+    std::string::size_type begin = 0;
+    while (begin < s.length()) {
+        std::string::size_type end = s.find(',', begin);
+        if (end == std::string::npos) {
+            end = s.length();
+        }
+        std::string entry = s.substr(begin, end - begin);
+        std::string::size_type colon = entry.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == entry.length()) {
+            redis_replicas.clear();
+            return false;
+        }
+        redis_replicas.push_back({entry.substr(0, colon), atoi(entry.c_str() + colon + 1)});
+        begin = end + 1;
+    }
+    replica_offsets.assign(redis_replicas.size(), -1);
+    return true;
+}
+
+size_t redis_replica_count() { return redis_replicas.size(); }
+
+const Redis_endpoint &redis_replica(size_t i) { return redis_replicas[i]; }
+
+/**
+  @brief
+  Value of a "name=value" field in a slaveN line of INFO replication.
+*/
+static std::string info_field(const std::string &line, const char *name) {
+    std::string key = std::string(name) + "=";
+    std::string::size_type pos = 0;
+    while ((pos = line.find(key, pos)) != std::string::npos) {
+        if (pos == 0 || line[pos - 1] == ',' || line[pos - 1] == ':') {
+            pos += key.length();
+            return line.substr(pos, line.find(',', pos) - pos);
+        }
+        pos++;
+    }
+    return "";
+}
+
+/**
+  @brief
+  Read the offsets of the primary and of the configured replicas.
+  Called with monitor_lock held.
+*/
+static bool refresh_offsets(redisContext *primary) {
+    DBUG_ENTER("refresh_offsets");
+    ulonglong now = my_micro_time();
+    redisReply *reply = (redisReply *)redisCommand(primary, "INFO replication");
+    if (!reply) {
+        DBUG_RETURN(false);
+    }
+    if (reply->type != REDIS_REPLY_STRING) {
+        freeReplyObject(reply);
+        DBUG_RETURN(false);
+    }
+
+    replica_offsets.assign(redis_replicas.size(), -1);
+    std::string info(reply->str, reply->len);
+    freeReplyObject(reply);
+
+    std::string::size_type begin = 0;
+    while (begin < info.length()) {
+        std::string::size_type end = info.find("\r\n", begin);
+        if (end == std::string::npos) {
+            end = info.length();
+        }
+        std::string line = info.substr(begin, end - begin);
+        begin = end + 2;
+
+        if (line.compare(0, 19, "master_repl_offset:") == 0) {
+            primary_offset = atoll(line.c_str() + 19);
+        } else if (line.compare(0, 5, "slave") == 0 &&
+                   info_field(line, "state") == "online") {
+            std::string ip = info_field(line, "ip");
+            int port = atoi(info_field(line, "port").c_str());
+            for (size_t i = 0; i < redis_replicas.size(); i++) {
+                if (redis_replicas[i].host == ip && redis_replicas[i].port == port) {
+                    replica_offsets[i] = atoll(info_field(line, "offset").c_str());
+                }
+            }
+        }
+    }
+    checked_at = now;
+    DBUG_RETURN(true);
+}
+
+int redis_pick_replica(redisContext *primary, ulonglong max_lag,
+                       Redis_read_point *read_point) {
+    DBUG_ENTER("redis_pick_replica");
+    if (redis_replicas.empty()) {
+        DBUG_RETURN(-1);
+    }
+
+    std::lock_guard<std::mutex> guard(monitor_lock);
+    ulonglong now = my_micro_time();
+    // a session which wrote since the last check needs an offset past its writes
+    if (now - checked_at > REDIS_REPLICATION_CHECK_INTERVAL ||
+        (read_point->last_write && read_point->last_write >= checked_at)) {
+        if (!refresh_offsets(primary)) {
+            DBUG_RETURN(-1);
+        }
+    }
+    if (read_point->last_write) {
+        if (read_point->last_write >= checked_at) {
+            DBUG_RETURN(-1);
+        }
+        read_point->offset = primary_offset;
+        read_point->last_write = 0;
+    }
+    if (read_point->offset > primary_offset) {
+        // the primary started a new replication history (restart, failover)
+        read_point->offset = primary_offset;
+    }
+
+    size_t n = redis_replicas.size();
+    size_t first = next_replica++ % n;
+    for (size_t i = 0; i < n; i++) {
+        size_t r = (first + i) % n;
+        longlong offset = replica_offsets[r];
+        if (offset >= 0 && offset + (longlong)max_lag >= primary_offset &&
+            offset >= read_point->offset) {
+            DBUG_RETURN((int)r);
+        }
+    }
+    DBUG_RETURN(-1);
+}
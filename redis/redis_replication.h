@@ -0,0 +1,99 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/** @file redis_replication.h
+
+    @brief
+  Replica endpoints and the replication lag monitor of the redis storage
+  engine.
+
+    @details
+  Read-only statements may be served by a replica when it is close enough
+  to the primary. How close is measured in bytes of replication stream:
+  the primary's master_repl_offset minus the offset a replica acknowledged,
+  both taken from INFO replication on the primary. The result is shared by
+  all sessions and refreshed at most every REDIS_REPLICATION_CHECK_INTERVAL,
+  or earlier when a session needs to see its own writes.
+
+   @see
+  /storage/redis/ha_redis.cc
+*/
+
+#ifndef REDIS_REPLICATION_INCLUDED
+#define REDIS_REPLICATION_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "my_inttypes.h"
+
+#include "hiredis.h" /* for redis */
+
+/** Microseconds an INFO replication result is trusted for */
+#define REDIS_REPLICATION_CHECK_INTERVAL 100000
+
+/** host:port of a Redis server */
+struct Redis_endpoint {
+    std::string host;
+    int port;
+};
+
+/**
+  What a session must be able to read: set when the session writes, and
+  resolved into a replication offset the next time it reads.
+*/
+struct Redis_read_point {
+    ulonglong last_write;  ///< my_micro_time() of the last write, 0 if resolved
+    longlong offset;       ///< primary offset which includes the session's writes
+
+    Redis_read_point() : last_write(0), offset(0) {}
+};
+
+/**
+  Parse a comma separated list of host:port into the replica endpoints.
+  Called once at plugin init.
+
+  @return false if an entry is malformed.
+*/
+bool redis_replicas_init(const char *list);
+
+/** Number of configured replicas */
+size_t redis_replica_count();
+
+/** Endpoint of a configured replica */
+const Redis_endpoint &redis_replica(size_t i);
+
+/**
+  Choose a replica which has applied the primary's stream up to max_lag
+  bytes and, if the session wrote, up to its writes. Replicas are chosen
+  in turn among those which qualify.
+
+  @param primary     connection to the primary, used to refresh the offsets
+  @param max_lag     tolerated lag in bytes
+  @param read_point  read point of the session, resolved on the way
+
+  @return index of the replica, or -1 to read from the primary.
+*/
+int redis_pick_replica(redisContext *primary, ulonglong max_lag,
+                       Redis_read_point *read_point);
+
+#endif /* REDIS_REPLICATION_INCLUDED */
@@ -0,0 +1,1376 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/**
+  @file redis_scripts.cc
+
+  @brief
+  Registry of the Lua scripts run by the redis storage engine.
+
+  @details
+  Positions handed to and returned from the scripts are the 1-based
+  positions used by ha_redis::position(); list indexes are 0-based.
+*/
+
+#include "redis_scripts.h"
+
+#include <string.h>
+
+#include "my_dbug.h"
+#include "my_inttypes.h"
+#include "redis_arena.h"
+#include "redis_io.h"
+#include "sha1.h"
+
+#define REDIS_STRINGIFY_(x) #x
+#define REDIS_STRINGIFY(x) REDIS_STRINGIFY_(x)
+#define BUCKET_ROWS REDIS_STRINGIFY(REDIS_BUCKET_ROWS)
+
+/*
+  Lua helpers of the list scripts: the positions of the tombstones are
+  kept in the list KEYS[6] (<table>:free), so that inserts take their
+  place instead of growing the list (positions don't move, unlike when the
+  list is compacted). free() records a tombstone, place() stores a row in
+  a free position or appends it, and returns its position.
+*/
+#define FREE_SLOTS \
+    "local function free(pos)\n" \
+    "  redis.call('RPUSH', KEYS[6], pos)\n" \
+    "end\n" \
+    "local function place(row)\n" \
+    "  local pos = redis.call('LPOP', KEYS[6])\n" \
+    "  while pos do\n" \
+    "    pos = tonumber(pos)\n" \
+    "    if redis.call('LINDEX', KEYS[1], pos - 1) == '" REDIS_TOMBSTONE "' then\n" \
+    "      redis.call('LSET', KEYS[1], pos - 1, row)\n" \
+    "      return pos\n" \
+    "    end\n" \
+    "    pos = redis.call('LPOP', KEYS[6])\n" \
+    "  end\n" \
+    "  return redis.call('RPUSH', KEYS[1], row)\n" \
+    "end\n"
+
+/*
+  Lua helpers of the list scripts reading rows which expire, on top of
+  FREE_SLOTS and ROW_EXPIRY: reclaim() turns the expired row at a
+  position into a tombstone, frees the position and deletes the row's
+  index entry, whose key the row carries (see REDIS_ROW_MAGIC_EXPIRY_KEY).
+  A row of a table with an index written before rows carried their key is
+  left to OPTIMIZE TABLE. Returns whether the row was reclaimed.
+*/
+#define RECLAIM \
+    "local function reclaim(pos, row)\n" \
+    "  local key = ''\n" \
+    "  if KEYS[2] ~= '' then\n" \
+    "    if string.byte(row, 2) ~= 3 then return false end\n" \
+    "    local n = string.byte(row, 11) + 256 * string.byte(row, 12)\n" \
+    "    key = string.sub(row, 13, 12 + n)\n" \
+    "  end\n" \
+    "  redis.call('LSET', KEYS[1], pos - 1, '" REDIS_TOMBSTONE "')\n" \
+    "  free(pos)\n" \
+    "  if key ~= '' and redis.call('HGET', KEYS[2], key) == string.format('%d', pos) then\n" \
+    "    redis.call('HDEL', KEYS[2], key)\n" \
+    "  end\n" \
+    "  return true\n" \
+    "end\n"
+
+/*
+  Lua helpers of the bucket scripts: the field of a row id in its bucket,
+  which the handler passes in KEYS, and take_id(), which raises the last
+  row id of the table (see ha_redis::next_row_id()) to the id of a row
+  stored, so that the ids reserved next don't collide with it.
+*/
+#define BUCKET_FUNCTIONS \
+    "local function field(id) return string.format('%d', id % " BUCKET_ROWS ") end\n" \
+    "local function take_id(id)\n" \
+    "  if tonumber(redis.call('HGET', KEYS[1], 'id') or 0) < id then\n" \
+    "    redis.call('HSET', KEYS[1], 'id', string.format('%d', id))\n" \
+    "  end\n" \
+    "end\n"
+
+/*
+  Lua of the insert and update scripts: raise the auto increment counter
+  KEYS[4] to the value of the Lua expression value unless that is ''
+*/
+#define AUTO_INC_RAISE(value) \
+    "if " value " ~= '' and\n" \
+    "   tonumber(redis.call('GET', KEYS[4]) or 0) < tonumber(" value ") then\n" \
+    "  redis.call('SET', KEYS[4], " value ")\n" \
+    "end\n"
+
+/*
+  Lua helpers of the write scripts for rows which expire: the time a row
+  expires at (see REDIS_ROW_MAGIC_EXPIRY), nil for a row of a table whose
+  rows don't, whether a row has expired, and keep(), which makes a key of
+  the table live at least as long as a row written into it. ttl is the
+  PTTL of the key before the write: a new key gets the expiry of the row,
+  a key which expires earlier is extended, a row which never expires
+  makes the key persistent. A table nobody writes to anymore thus goes
+  away as a whole once its last row has expired.
+*/
+#define ROW_EXPIRY \
+    "local now\n" \
+    "local function clock()\n" \
+    "  if not now then\n" \
+    "    local t = redis.call('TIME')\n" \
+    "    now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000)\n" \
+    "  end\n" \
+    "  return now\n" \
+    "end\n" \
+    "local function expiry(row)\n" \
+    "  local magic = string.byte(row, 2)\n" \
+    "  if string.byte(row, 1) ~= 255 or (magic ~= 2 and magic ~= 3) then return nil end\n" \
+    "  local at = 0\n" \
+    "  for i = 10, 3, -1 do at = at * 256 + string.byte(row, i) end\n" \
+    "  return at\n" \
+    "end\n" \
+    "local function expired(row)\n" \
+    "  local at = row and expiry(row)\n" \
+    "  if not at or at == 0 then return false end\n" \
+    "  return at <= clock()\n" \
+    "end\n" \
+    "local function keep(key, ttl, at)\n" \
+    "  if at == 0 then\n" \
+    "    if ttl >= 0 then redis.call('PERSIST', key) end\n" \
+    "  elseif ttl == -2 or (ttl >= 0 and clock() + ttl < at) then\n" \
+    "    redis.call('PEXPIREAT', key, string.format('%d', at))\n" \
+    "  end\n" \
+    "end\n"
+
+/*
+  Lua of the write scripts: keep_keys() gives the other keys of a table
+  (out-of-line values, auto increment counter, live checksum, free
+  positions and last entry ID) the expiry of KEYS[1], so that they go
+  away with the rows.
+  Writes of rows which expire pass their expiry time, 0 making the keys
+  persistent; deletes pass nothing and only follow an expiring KEYS[1].
+*/
+#define KEY_EXPIRY \
+    "local function keep_keys(at)\n" \
+    "  local ttl = redis.call('PTTL', KEYS[1])\n" \
+    "  if ttl == -2 or (ttl == -1 and not at) then return end\n" \
+    "  for _, key in ipairs({KEYS[3], KEYS[4], KEYS[5] or '', KEYS[6] or '', KEYS[7] or ''}) do\n" \
+    "    if key ~= '' then\n" \
+    "      if ttl == -1 then\n" \
+    "        redis.call('PERSIST', key)\n" \
+    "      else\n" \
+    "        redis.call('PEXPIRE', key, ttl)\n" \
+    "      end\n" \
+    "    end\n" \
+    "  end\n" \
+    "end\n"
+
+/*
+  Lua of the bucket scripts: let Redis drop the field of a row, or of its
+  index key, when the row expires. Hash fields expire since Redis 7.4,
+  before that the calls fail and the rows are only filtered by readers.
+*/
+#define FIELD_EXPIRY \
+    "local function expire_field(key, name, at)\n" \
+    "  if at == 0 then\n" \
+    "    redis.pcall('HPERSIST', key, 'FIELDS', 1, name)\n" \
+    "  else\n" \
+    "    redis.pcall('HPEXPIREAT', key, string.format('%d', at), 'FIELDS', 1, name)\n" \
+    "  end\n" \
+    "end\n"
+
+/*
+  Lua of the write scripts: keep the live checksum of a table in KEYS[5]
+  ('' if the table has none). It is the sum modulo 2^32 of a hash of each
+  row, which doesn't depend on the order of the rows. checksum() accounts
+  for a row written and for the row it replaced or deleted; either may be
+  nil.
+*/
+#define ROW_CHECKSUM \
+    "local function row_hash(row)\n" \
+    "  return tonumber(string.sub(redis.sha1hex(row), 1, 8), 16)\n" \
+    "end\n" \
+    "local function checksum(added, removed)\n" \
+    "  if not KEYS[5] or KEYS[5] == '' then return end\n" \
+    "  local sum = tonumber(redis.call('GET', KEYS[5]) or 0)\n" \
+    "  if added then sum = sum + row_hash(added) end\n" \
+    "  if removed then sum = sum - row_hash(removed) end\n" \
+    "  redis.call('SET', KEYS[5], string.format('%d', sum % 4294967296))\n" \
+    "end\n"
+
+/*
+  Lua of the stream scripts: the key and the sequence number of the last
+  entry ID the stream key has taken, '0' and 0 for none. Redis doesn't take
+  an ID up to the one of a deleted entry again: REDIS_SCRIPT_STREAM_DELETE
+  keeps the ID of the last entry it deletes in last_key (<stream>:last)
+  until the next insert.
+*/
+#define STREAM_LAST \
+    "local function stream_last(key, last_key)\n" \
+    "  local id = redis.call('GET', last_key)\n" \
+    "  if not id then\n" \
+    "    local entry = redis.call('XREVRANGE', key, '+', '-', 'COUNT', 1)[1]\n" \
+    "    if not entry then return '0', 0 end\n" \
+    "    id = entry[1]\n" \
+    "  end\n" \
+    "  local last, seq = string.match(id, '(%d+)-(%d+)')\n" \
+    "  return last, tonumber(seq)\n" \
+    "end\n"
+
+/*
+  Lua of the scan scripts: the condition the handler pushed down (see
+  ha_redis::cond_push()), in ARGV[first] on. ARGV[first] is the layout of
+  the columns up to the last one it reads, a word per column: f<bytes> for
+  a fixed width column, v<length bytes> for a VARCHAR, b for a BLOB and g
+  for the others. Then come 4 arguments per term: the 1-based column, the
+  operator ('=', '<>', '<', '<=', '>', '>=', 'null' or 'notnull'), 's' or
+  'u' for a signed or an unsigned integer column, and the constant, 9
+  bytes which compare as the numbers do (see redis_filter_value()).
+  match() tells whether a row passes all terms, nil if it can't tell: for
+  a row of the text format, or one written before a column the condition
+  reads was added, which the handler decodes to check.
+*/
+#define ROW_FILTER \
+    "local layout, terms = {}, {}\n" \
+    "local function filter(first)\n" \
+    "  if not ARGV[first] or ARGV[first] == '' then return end\n" \
+    "  for kind, n in string.gmatch(ARGV[first], '(%a)(%d*)') do\n" \
+    "    layout[#layout + 1] = {kind, tonumber(n) or 0}\n" \
+    "  end\n" \
+    "  for i = first + 1, #ARGV - 3, 4 do\n" \
+    "    terms[#terms + 1] = {tonumber(ARGV[i]), ARGV[i + 1], ARGV[i + 2] == 's',\n" \
+    "                         {string.byte(ARGV[i + 3], 1, 9)}}\n" \
+    "  end\n" \
+    "end\n" \
+    "local function number_at(row, p, n)\n" \
+    "  local v = 0\n" \
+    "  for i = p + n - 1, p, -1 do v = v * 256 + string.byte(row, i) end\n" \
+    "  return v\n" \
+    "end\n" \
+    "local function values(row)\n" \
+    "  local mark, magic = string.byte(row, 1, 2)\n" \
+    "  if mark ~= 255 or not magic or magic < 1 or magic > 3 then return nil end\n" \
+    "  local h = magic == 1 and 2 or 10\n" \
+    "  if magic == 3 then\n" \
+    "    if #row < 12 then return nil end\n" \
+    "    h = 12 + number_at(row, 11, 2)\n" \
+    "  end\n" \
+    "  if #row < h + 2 then return nil end\n" \
+    "  local count = number_at(row, h + 1, 2)\n" \
+    "  local bitmap = h + 3\n" \
+    "  local p = bitmap + math.floor((count + 7) / 8)\n" \
+    "  local at = {}\n" \
+    "  for i = 1, math.min(count, #layout) do\n" \
+    "    local kind, n = layout[i][1], layout[i][2]\n" \
+    "    local null = math.floor(string.byte(row, bitmap + math.floor((i - 1) / 8)) /\n" \
+    "                            2 ^ ((i - 1) % 8)) % 2 == 1\n" \
+    "    if null then\n" \
+    "      at[i] = false\n" \
+    "    else\n" \
+    "      at[i] = p\n" \
+    "      if kind == 'f' then\n" \
+    "        p = p + n\n" \
+    "      elseif kind == 'v' then\n" \
+    "        if p + n - 1 > #row then return nil end\n" \
+    "        p = p + n + number_at(row, p, n)\n" \
+    "      else\n" \
+    "        if p + 3 > #row then return nil end\n" \
+    "        local length = number_at(row, p, 4)\n" \
+    "        if length == 4294967295 then\n" \
+    "          if p + 8 > #row then return nil end\n" \
+    "          p = p + 9 + string.byte(row, p + 8)\n" \
+    "        else\n" \
+    "          p = p + 4 + length\n" \
+    "        end\n" \
+    "      end\n" \
+    "      if p - 1 > #row then return nil end\n" \
+    "    end\n" \
+    "  end\n" \
+    "  return at\n" \
+    "end\n" \
+    "local function compare(row, p, n, signed, k)\n" \
+    "  local negative = signed and string.byte(row, p + n - 1) >= 128\n" \
+    "  local v = {negative and 0 or 1}\n" \
+    "  for i = 8, 1, -1 do\n" \
+    "    v[#v + 1] = i <= n and string.byte(row, p + i - 1) or (negative and 255 or 0)\n" \
+    "  end\n" \
+    "  for i = 1, 9 do\n" \
+    "    if v[i] ~= k[i] then return v[i] < k[i] and -1 or 1 end\n" \
+    "  end\n" \
+    "  return 0\n" \
+    "end\n" \
+    "local function match(row)\n" \
+    "  if #terms == 0 then return true end\n" \
+    "  local at = values(row)\n" \
+    "  if not at then return nil end\n" \
+    "  local result = true\n" \
+    "  for _, t in ipairs(terms) do\n" \
+    "    local p, op, ok = at[t[1]], t[2], nil\n" \
+    "    if p == nil then\n" \
+    "      ok = nil\n" \
+    "    elseif op == 'null' then\n" \
+    "      ok = not p\n" \
+    "    elseif op == 'notnull' then\n" \
+    "      ok = p ~= false\n" \
+    "    elseif not p then\n" \
+    "      ok = false\n" \
+    "    else\n" \
+    "      local c = compare(row, p, layout[t[1]][2], t[3], t[4])\n" \
+    "      ok = (op == '=' and c == 0) or (op == '<>' and c ~= 0) or (op == '<' and c < 0) or\n" \
+    "           (op == '<=' and c <= 0) or (op == '>' and c > 0) or (op == '>=' and c >= 0)\n" \
+    "    end\n" \
+    "    if ok == false then return false end\n" \
+    "    if ok == nil then result = nil end\n" \
+    "  end\n" \
+    "  return result\n" \
+    "end\n"
+
+/*
+  Script sources, indexed by redis_script_id.
+*/
+static const char *redis_script_sources[REDIS_SCRIPT_MAX] = {
+    /*
+      REDIS_SCRIPT_FETCH
+      KEYS[1] list, ARGV[1] 0-based start index, ARGV[2] max rows,
+      ARGV[3] 'reclaim' to reclaim the expired rows met (see RECLAIM),
+      which then needs the other keys of the row scripts, ARGV[4..] the
+      pushed condition (see ROW_FILTER).
+      Returns {next start index, pos1, row1, pos2, row2, ...}, skipping
+      tombstones and the rows failing the condition. An empty list past
+      the end of the table means EOF.
+    */
+    ROW_EXPIRY
+    FREE_SLOTS
+    RECLAIM
+    ROW_FILTER
+    "filter(4)\n"
+    "local start = tonumber(ARGV[1])\n"
+    "local rows = redis.call('LRANGE', KEYS[1], start,"
+    " start + tonumber(ARGV[2]) - 1)\n"
+    "local res = {start + #rows}\n"
+    "for i, row in ipairs(rows) do\n"
+    "  if row ~= '" REDIS_TOMBSTONE "' and\n"
+    "     not (ARGV[3] == 'reclaim' and expired(row) and reclaim(start + i, row)) and\n"
+    "     match(row) ~= false then\n"
+    "    res[#res + 1] = start + i\n"
+    "    res[#res + 1] = row\n"
+    "  end\n"
+    "end\n"
+    "return res\n",
+
+    /*
+      REDIS_SCRIPT_INSERT
+      KEYS[1] list, KEYS[2] index, KEYS[3] out-of-line values,
+      KEYS[4] auto increment counter; ARGV[1] row, ARGV[2] index key,
+      ARGV[3] auto increment value the counter must reach ('' for none),
+      ARGV[4..] id, value pairs to store; KEYS[5] live checksum, KEYS[6]
+      free positions (see FREE_SLOTS). The index
+      key is '' for a key with a NULL part, which gets no index entry.
+      Returns the position of the new row, which takes the place of an
+      expired row holding the key, or of a tombstone.
+    */
+    ROW_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    FREE_SLOTS
+    "local index = KEYS[2] ~= '' and ARGV[2] ~= '' and KEYS[2]\n"
+    "local at = expiry(ARGV[1])\n"
+    "local ttl = at and redis.call('PTTL', KEYS[1])\n"
+    "local index_ttl = at and index and redis.call('PTTL', index)\n"
+    "local pos\n"
+    "if index then\n"
+    "  local dup = redis.call('HGET', index, ARGV[2])\n"
+    "  if dup then\n"
+    "    pos = tonumber(dup)\n"
+    "    if not expired(redis.call('LINDEX', KEYS[1], pos - 1)) then return -pos end\n"
+    "    redis.call('LSET', KEYS[1], pos - 1, ARGV[1])\n"
+    "  end\n"
+    "end\n"
+    "pos = pos or place(ARGV[1])\n"
+    "checksum(ARGV[1])\n"
+    "if index then redis.call('HSET', index, ARGV[2], pos) end\n"
+    "if at then\n"
+    "  keep(KEYS[1], ttl, at)\n"
+    "  if index then keep(index, index_ttl, at) end\n"
+    "end\n"
+    AUTO_INC_RAISE("ARGV[3]")
+    "for i = 4, #ARGV, 2 do\n"
+    "  redis.call('HSET', KEYS[3], ARGV[i], ARGV[i + 1])\n"
+    "end\n"
+    "if at then keep_keys(at) end\n"
+    "return pos\n",
+
+    /*
+      REDIS_SCRIPT_UPDATE
+      KEYS[1] list, KEYS[2] index, KEYS[3] out-of-line values,
+      KEYS[4] auto increment counter; ARGV[1] position, ARGV[2] expected
+      row, ARGV[3] new row, ARGV[4] old index key, ARGV[5] new index key
+      ('' for a key with a NULL part), ARGV[6] number n of id, value pairs
+      to store, ARGV[7] auto increment value the counter must reach (''
+      for none), the n pairs, then the ids to delete.
+    */
+    ROW_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    FREE_SLOTS
+    "local index = KEYS[2] ~= '' and KEYS[2]\n"
+    "local idx = tonumber(ARGV[1]) - 1\n"
+    "if redis.call('LINDEX', KEYS[1], idx) ~= ARGV[2] then return 0 end\n"
+    "local at = expiry(ARGV[3])\n"
+    "if index and ARGV[4] ~= ARGV[5] then\n"
+    "  if ARGV[5] ~= '' then\n"
+    "    local dup = redis.call('HGET', index, ARGV[5])\n"
+    "    if dup then\n"
+    "      local dup_idx = tonumber(dup) - 1\n"
+    "      if not expired(redis.call('LINDEX', KEYS[1], dup_idx)) then return -tonumber(dup) end\n"
+    "      redis.call('LSET', KEYS[1], dup_idx, '" REDIS_TOMBSTONE "')\n"
+    "      free(dup)\n"
+    "    end\n"
+    "    redis.call('HSET', index, ARGV[5], ARGV[1])\n"
+    "  end\n"
+    "  if ARGV[4] ~= '' then redis.call('HDEL', index, ARGV[4]) end\n"
+    "end\n"
+    "redis.call('LSET', KEYS[1], idx, ARGV[3])\n"
+    "checksum(ARGV[3], ARGV[2])\n"
+    "if at then\n"
+    "  keep(KEYS[1], redis.call('PTTL', KEYS[1]), at)\n"
+    "  if index then keep(index, redis.call('PTTL', index), at) end\n"
+    "end\n"
+    AUTO_INC_RAISE("ARGV[7]")
+    "local stored = 7 + 2 * tonumber(ARGV[6])\n"
+    "for i = 8, stored, 2 do\n"
+    "  redis.call('HSET', KEYS[3], ARGV[i], ARGV[i + 1])\n"
+    "end\n"
+    "for i = stored + 1, #ARGV do\n"
+    "  redis.call('HDEL', KEYS[3], ARGV[i])\n"
+    "end\n"
+    "if at then keep_keys(at) end\n"
+    "return 1\n",
+
+    /*
+      REDIS_SCRIPT_DELETE
+      KEYS[1] list, KEYS[2] index, KEYS[3] out-of-line values;
+      ARGV[1] position, ARGV[2] expected row, ARGV[3] index key,
+      ARGV[4..] ids of the row's out-of-line values.
+    */
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    FREE_SLOTS
+    "local idx = tonumber(ARGV[1]) - 1\n"
+    "if redis.call('LINDEX', KEYS[1], idx) ~= ARGV[2] then return 0 end\n"
+    "redis.call('LSET', KEYS[1], idx, '" REDIS_TOMBSTONE "')\n"
+    "free(ARGV[1])\n"
+    "checksum(nil, ARGV[2])\n"
+    "if KEYS[2] ~= '' and ARGV[3] ~= '' then redis.call('HDEL', KEYS[2], ARGV[3]) end\n"
+    "for i = 4, #ARGV do\n"
+    "  redis.call('HDEL', KEYS[3], ARGV[i])\n"
+    "end\n"
+    "keep_keys()\n"
+    "return 1\n",
+
+    /*
+      REDIS_SCRIPT_LOOKUP
+      KEYS[1] list, KEYS[2] index; ARGV[1] index key.
+      Returns {position, row}, or an empty list if there is no such key.
+    */
+    "local pos = redis.call('HGET', KEYS[2], ARGV[1])\n"
+    "if not pos then return {} end\n"
+    "local row = redis.call('LINDEX', KEYS[1], tonumber(pos) - 1)\n"
+    "if not row or row == '" REDIS_TOMBSTONE "' then return {} end\n"
+    "return {tonumber(pos), row}\n",
+
+    /*
+      REDIS_SCRIPT_COMPACT
+      KEYS[1] list, KEYS[2] index, KEYS[6] free positions; ARGV[1]
+      'expiry' if rows of the table expire, which are then removed as well.
+      Removes the tombstones. As this shifts the positions of the rows
+      behind them, the positions stored in the index are renumbered, and
+      the free positions (see FREE_SLOTS) are forgotten.
+      Returns the number of removed tombstones.
+    */
+    ROW_EXPIRY
+    "local rows\n"
+    "if ARGV[1] == 'expiry' then\n"
+    "  rows = redis.call('LRANGE', KEYS[1], 0, -1)\n"
+    "  for i, row in ipairs(rows) do\n"
+    "    if expired(row) then\n"
+    "      redis.call('LSET', KEYS[1], i - 1, '" REDIS_TOMBSTONE "')\n"
+    "      rows[i] = '" REDIS_TOMBSTONE "'\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "redis.call('DEL', KEYS[6])\n"
+    "if KEYS[2] == '' then\n"
+    "  return redis.call('LREM', KEYS[1], 0, '" REDIS_TOMBSTONE "')\n"
+    "end\n"
+    "rows = rows or redis.call('LRANGE', KEYS[1], 0, -1)\n"
+    "local renumber = {}\n"
+    "local live = 0\n"
+    "for i, row in ipairs(rows) do\n"
+    "  if row ~= '" REDIS_TOMBSTONE "' then\n"
+    "    live = live + 1\n"
+    "    renumber[i] = live\n"
+    "  end\n"
+    "end\n"
+    "if live == #rows then return 0 end\n"
+    "redis.call('LREM', KEYS[1], 0, '" REDIS_TOMBSTONE "')\n"
+    "local index = redis.call('HGETALL', KEYS[2])\n"
+    "for i = 1, #index, 2 do\n"
+    "  local pos = renumber[tonumber(index[i + 1])]\n"
+    "  if pos then\n"
+    "    redis.call('HSET', KEYS[2], index[i], pos)\n"
+    "  else\n"
+    "    redis.call('HDEL', KEYS[2], index[i])\n"
+    "  end\n"
+    "end\n"
+    "return #rows - live\n",
+
+    /*
+      REDIS_SCRIPT_RENAME
+      KEYS[1..n] keys of the table, KEYS[n+1..2n] their new names.
+      Keys which don't exist (e.g. the list of an empty table) leave no
+      stale key behind under the new name.
+    */
+    "local n = #KEYS / 2\n"
+    "for i = 1, n do\n"
+    "  if redis.call('EXISTS', KEYS[i]) == 1 then\n"
+    "    redis.call('RENAME', KEYS[i], KEYS[n + i])\n"
+    "  else\n"
+    "    redis.call('DEL', KEYS[n + i])\n"
+    "  end\n"
+    "end\n"
+    "return n\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_FETCH
+      KEYS[1] table, KEYS[2..] the buckets of the chunk to read, from
+      bucket ARGV[1] on, ARGV[4..] the pushed condition (ARGV[2] and
+      ARGV[3] as for REDIS_SCRIPT_FETCH are unused). Returns {next bucket,
+      pos1, row1, ...}; the next bucket is the first one when it is past
+      the last row id (EOF).
+    */
+    ROW_FILTER
+    "filter(4)\n"
+    "local first = tonumber(ARGV[1])\n"
+    "local last = tonumber(redis.call('HGET', KEYS[1], 'id') or 0)\n"
+    "if first * " BUCKET_ROWS " > last then return {first} end\n"
+    "local res = {first + #KEYS - 1}\n"
+    "for i = 2, #KEYS do\n"
+    "  local b = first + i - 2\n"
+    "  local rows = redis.call('HGETALL', KEYS[i])\n"
+    "  for j = 1, #rows, 2 do\n"
+    "    if match(rows[j + 1]) ~= false then\n"
+    "      res[#res + 1] = b * " BUCKET_ROWS " + tonumber(rows[j])\n"
+    "      res[#res + 1] = rows[j + 1]\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "return res\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_INSERT
+      As REDIS_SCRIPT_INSERT; ARGV[4] is the row id of the new row (see
+      ha_redis::next_row_id()) and KEYS[8] its bucket, ARGV[5] the row id
+      of the row which held the index key when the handler looked ('' for
+      none) and KEYS[9] its bucket; the id, value pairs start at ARGV[6].
+      A row holding the key is read only if rows of the table expire: an
+      expired one is deleted. If the key is held by another row than
+      ARGV[5], returns {row id} of that row, to be called again with its
+      bucket. Returns the row id of the new row, 0 if it is taken.
+    */
+    BUCKET_FUNCTIONS
+    ROW_EXPIRY
+    FIELD_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    "local index = KEYS[2] ~= '' and ARGV[2] ~= '' and KEYS[2]\n"
+    "local at = expiry(ARGV[1])\n"
+    "local id = tonumber(ARGV[4])\n"
+    "if redis.call('HEXISTS', KEYS[8], field(id)) == 1 then return 0 end\n"
+    "if index then\n"
+    "  local dup = redis.call('HGET', index, ARGV[2])\n"
+    "  if dup then\n"
+    "    if not at then return -tonumber(dup) end\n"
+    "    if dup ~= ARGV[5] then return {tonumber(dup)} end\n"
+    "    dup = tonumber(dup)\n"
+    "    if not expired(redis.call('HGET', KEYS[9], field(dup))) then return -dup end\n"
+    "    redis.call('HDEL', KEYS[9], field(dup))\n"
+    "  end\n"
+    "end\n"
+    "local ttl = at and redis.call('PTTL', KEYS[1])\n"
+    "take_id(id)\n"
+    "local bucket_ttl = at and redis.call('PTTL', KEYS[8])\n"
+    "local index_ttl = at and index and redis.call('PTTL', index)\n"
+    "redis.call('HSET', KEYS[8], field(id), ARGV[1])\n"
+    "checksum(ARGV[1])\n"
+    "if index then redis.call('HSET', index, ARGV[2], ARGV[4]) end\n"
+    "if at then\n"
+    "  keep(KEYS[1], ttl, at)\n"
+    "  keep(KEYS[8], bucket_ttl, at)\n"
+    "  expire_field(KEYS[8], field(id), at)\n"
+    "  if index then\n"
+    "    keep(index, index_ttl, at)\n"
+    "    expire_field(index, ARGV[2], at)\n"
+    "  end\n"
+    "end\n"
+    AUTO_INC_RAISE("ARGV[3]")
+    "for i = 6, #ARGV, 2 do\n"
+    "  redis.call('HSET', KEYS[3], ARGV[i], ARGV[i + 1])\n"
+    "end\n"
+    "if at then keep_keys(at) end\n"
+    "return id\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_UPDATE
+      As REDIS_SCRIPT_UPDATE, ARGV[1] is the row id and KEYS[8] its bucket.
+      ARGV[8] and KEYS[9] are the row which held the new index key and its
+      bucket, as ARGV[5] and KEYS[9] of REDIS_SCRIPT_BUCKET_INSERT; the
+      pairs start at ARGV[9].
+    */
+    BUCKET_FUNCTIONS
+    ROW_EXPIRY
+    FIELD_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    "local index = KEYS[2] ~= '' and KEYS[2]\n"
+    "local id = tonumber(ARGV[1])\n"
+    "if redis.call('HGET', KEYS[8], field(id)) ~= ARGV[2] then return 0 end\n"
+    "local at = expiry(ARGV[3])\n"
+    "if index and ARGV[4] ~= ARGV[5] then\n"
+    "  if ARGV[5] ~= '' then\n"
+    "    local dup = redis.call('HGET', index, ARGV[5])\n"
+    "    if dup then\n"
+    "      if not at then return -tonumber(dup) end\n"
+    "      if dup ~= ARGV[8] then return {tonumber(dup)} end\n"
+    "      dup = tonumber(dup)\n"
+    "      if not expired(redis.call('HGET', KEYS[9], field(dup))) then return -dup end\n"
+    "      redis.call('HDEL', KEYS[9], field(dup))\n"
+    "    end\n"
+    "    redis.call('HSET', index, ARGV[5], ARGV[1])\n"
+    "  end\n"
+    "  if ARGV[4] ~= '' then redis.call('HDEL', index, ARGV[4]) end\n"
+    "end\n"
+    "redis.call('HSET', KEYS[8], field(id), ARGV[3])\n"
+    "checksum(ARGV[3], ARGV[2])\n"
+    "if at then\n"
+    "  keep(KEYS[1], redis.call('PTTL', KEYS[1]), at)\n"
+    "  keep(KEYS[8], redis.call('PTTL', KEYS[8]), at)\n"
+    "  expire_field(KEYS[8], field(id), at)\n"
+    "  if index and ARGV[5] ~= '' then\n"
+    "    keep(index, redis.call('PTTL', index), at)\n"
+    "    expire_field(index, ARGV[5], at)\n"
+    "  end\n"
+    "end\n"
+    "redis.call('HINCRBY', KEYS[1], 'version', 1)\n"
+    AUTO_INC_RAISE("ARGV[7]")
+    "local stored = 8 + 2 * tonumber(ARGV[6])\n"
+    "for i = 9, stored, 2 do\n"
+    "  redis.call('HSET', KEYS[3], ARGV[i], ARGV[i + 1])\n"
+    "end\n"
+    "for i = stored + 1, #ARGV do\n"
+    "  redis.call('HDEL', KEYS[3], ARGV[i])\n"
+    "end\n"
+    "if at then keep_keys(at) end\n"
+    "return 1\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_DELETE
+      As REDIS_SCRIPT_DELETE, ARGV[1] is the row id and KEYS[8] its bucket.
+      The row is removed right away: row ids don't move, so there are no
+      tombstones.
+    */
+    BUCKET_FUNCTIONS
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    "local id = tonumber(ARGV[1])\n"
+    "if redis.call('HGET', KEYS[8], field(id)) ~= ARGV[2] then return 0 end\n"
+    "redis.call('HDEL', KEYS[8], field(id))\n"
+    "checksum(nil, ARGV[2])\n"
+    "redis.call('HINCRBY', KEYS[1], 'version', 1)\n"
+    "if KEYS[2] ~= '' and ARGV[3] ~= '' then redis.call('HDEL', KEYS[2], ARGV[3]) end\n"
+    "for i = 4, #ARGV do\n"
+    "  redis.call('HDEL', KEYS[3], ARGV[i])\n"
+    "end\n"
+    "keep_keys()\n"
+    "return 1\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_LOOKUP
+      As REDIS_SCRIPT_LOOKUP; ARGV[2] is the row id the index key was
+      found at before ('' the first time) and KEYS[8] its bucket. If the
+      key is at another row, returns {row id} of that row, to be called
+      again with its bucket.
+    */
+    BUCKET_FUNCTIONS
+    "local id = redis.call('HGET', KEYS[2], ARGV[1])\n"
+    "if not id then return {} end\n"
+    "if id ~= ARGV[2] then return {tonumber(id)} end\n"
+    "id = tonumber(id)\n"
+    "local row = redis.call('HGET', KEYS[8], field(id))\n"
+    "if not row then return {} end\n"
+    "return {id, row}\n",
+
+    /*
+      REDIS_SCRIPT_AUTO_INC
+      KEYS[1] auto increment counter; ARGV[1] number of values, ARGV[2]
+      value the counter must be past first (explicit values inserted).
+      Returns the last value of the reserved range.
+    */
+    "local last = math.max(tonumber(redis.call('GET', KEYS[1]) or 0), tonumber(ARGV[2]))\n"
+    "last = last + tonumber(ARGV[1])\n"
+    "redis.call('SET', KEYS[1], string.format('%d', last))\n"
+    "return last\n",
+
+    /*
+      REDIS_SCRIPT_STREAM_FETCH
+      KEYS[1] stream; ARGV[1] first ID, ARGV[2] last ID, ARGV[3] max
+      entries, ARGV[4] 'rev' to read backwards (ARGV[1] is then the
+      higher ID), ARGV[5..] the pushed condition. Returns {number of
+      entries read, ID of the last one, id1, row1, id2, row2, ...}, without
+      the entries failing the condition.
+    */
+    ROW_FILTER
+    "filter(5)\n"
+    "local rows\n"
+    "if ARGV[4] == 'rev' then\n"
+    "  rows = redis.call('XREVRANGE', KEYS[1], ARGV[1], ARGV[2], 'COUNT', ARGV[3])\n"
+    "else\n"
+    "  rows = redis.call('XRANGE', KEYS[1], ARGV[1], ARGV[2], 'COUNT', ARGV[3])\n"
+    "end\n"
+    "local res = {#rows, #rows > 0 and rows[#rows][1] or ''}\n"
+    "for i, entry in ipairs(rows) do\n"
+    "  if match(entry[2][2]) ~= false then\n"
+    "    res[#res + 1] = entry[1]\n"
+    "    res[#res + 1] = entry[2][2]\n"
+    "  end\n"
+    "end\n"
+    "return res\n",
+
+    /*
+      REDIS_SCRIPT_STREAM_INSERT
+      KEYS as REDIS_SCRIPT_INSERT, KEYS[7] the ID of the last entry
+      deleted (see STREAM_LAST). Appends rows to a stream, ARGV holding
+      three values per row: the row, its key as a decimal number, which
+      becomes the first part of its entry ID, or '' to let Redis take the
+      current time, and its AUTO_INCREMENT value or ''. Stops at the first
+      row whose key is lower than the one of the last entry and returns the
+      number of rows added.
+    */
+    ROW_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    STREAM_LAST
+    "local last, seq = stream_last(KEYS[1], KEYS[7])\n"
+    "local added, kept = 0\n"
+    "for i = 1, #ARGV, 3 do\n"
+    "  local row, key, auto_inc = ARGV[i], ARGV[i + 1], ARGV[i + 2]\n"
+    "  local id = '*'\n"
+    "  if key ~= '' then\n"
+    "    if #key < #last or (#key == #last and key < last) then break end\n"
+    "    if key == last then seq = seq + 1 else last, seq = key, 0 end\n"
+    "    id = key .. '-' .. string.format('%d', seq)\n"
+    "  end\n"
+    "  local at = expiry(row)\n"
+    "  local ttl = at and redis.call('PTTL', KEYS[1])\n"
+    "  local ok = redis.pcall('XADD', KEYS[1], id, 'r', row)\n"
+    "  if type(ok) == 'table' and ok.err then break end\n"
+    "  checksum(row)\n"
+    "  if at then\n"
+    "    keep(KEYS[1], ttl, at)\n"
+    "    kept = at\n"
+    "  end\n"
+    AUTO_INC_RAISE("auto_inc")
+    "  added = added + 1\n"
+    "end\n"
+    "if added > 0 then redis.call('DEL', KEYS[7]) end\n"
+    "if kept then keep_keys(kept) end\n"
+    "return added\n",
+
+    /*
+      REDIS_SCRIPT_STREAM_DELETE
+      As REDIS_SCRIPT_DELETE, ARGV[1] is the entry ID. The ID of the last
+      entry is kept in KEYS[7] for STREAM_LAST.
+    */
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    "local entry = redis.call('XRANGE', KEYS[1], ARGV[1], ARGV[1])[1]\n"
+    "if not entry or entry[2][2] ~= ARGV[2] then return 0 end\n"
+    "local newest = redis.call('XREVRANGE', KEYS[1], '+', '-', 'COUNT', 1)[1]\n"
+    "if newest[1] == ARGV[1] and redis.call('SET', KEYS[7], ARGV[1], 'NX') then\n"
+    "  local ttl = redis.call('PTTL', KEYS[1])\n"
+    "  if ttl > 0 then redis.call('PEXPIRE', KEYS[7], ttl) end\n"
+    "end\n"
+    "redis.call('XDEL', KEYS[1], ARGV[1])\n"
+    "checksum(nil, ARGV[2])\n"
+    "for i = 4, #ARGV do\n"
+    "  redis.call('HDEL', KEYS[3], ARGV[i])\n"
+    "end\n"
+    "keep_keys()\n"
+    "return 1\n",
+
+    /*
+      REDIS_SCRIPT_REPLACE
+      As REDIS_SCRIPT_INSERT for a table with an index and without
+      out-of-line values. A row holding the key is overwritten where it
+      is, expired or not. Returns the position of the row.
+    */
+    ROW_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    FREE_SLOTS
+    "local at = expiry(ARGV[1])\n"
+    "local ttl = at and redis.call('PTTL', KEYS[1])\n"
+    "local index_ttl = at and redis.call('PTTL', KEYS[2])\n"
+    "local pos = redis.call('HGET', KEYS[2], ARGV[2])\n"
+    "local old\n"
+    "if pos then\n"
+    "  pos = tonumber(pos)\n"
+    "  old = redis.call('LINDEX', KEYS[1], pos - 1)\n"
+    "  redis.call('LSET', KEYS[1], pos - 1, ARGV[1])\n"
+    "else\n"
+    "  pos = place(ARGV[1])\n"
+    "  redis.call('HSET', KEYS[2], ARGV[2], pos)\n"
+    "end\n"
+    "checksum(ARGV[1], old)\n"
+    "if at then\n"
+    "  keep(KEYS[1], ttl, at)\n"
+    "  keep(KEYS[2], index_ttl, at)\n"
+    "end\n"
+    AUTO_INC_RAISE("ARGV[3]")
+    "if at then keep_keys(at) end\n"
+    "return pos\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_REPLACE
+      As REDIS_SCRIPT_REPLACE, with ARGV[4], ARGV[5], KEYS[8] and KEYS[9]
+      as for REDIS_SCRIPT_BUCKET_INSERT: the row is stored in the place of
+      row ARGV[5] if that still holds the key, else as the new row
+      ARGV[4] if no row does. Returns the row id of the row, or {row id}
+      of another row holding the key, to be called again with its bucket.
+    */
+    BUCKET_FUNCTIONS
+    ROW_EXPIRY
+    FIELD_EXPIRY
+    KEY_EXPIRY
+    ROW_CHECKSUM
+    "local at = expiry(ARGV[1])\n"
+    "local ttl = at and redis.call('PTTL', KEYS[1])\n"
+    "local index_ttl = at and redis.call('PTTL', KEYS[2])\n"
+    "local id = redis.call('HGET', KEYS[2], ARGV[2])\n"
+    "local bucket = KEYS[9]\n"
+    "if id and id ~= ARGV[5] then return {tonumber(id)} end\n"
+    "if id then\n"
+    "  id = tonumber(id)\n"
+    "else\n"
+    "  id = tonumber(ARGV[4])\n"
+    "  bucket = KEYS[8]\n"
+    "  if redis.call('HEXISTS', bucket, field(id)) == 1 then return 0 end\n"
+    "  take_id(id)\n"
+    "  redis.call('HSET', KEYS[2], ARGV[2], ARGV[4])\n"
+    "end\n"
+    "redis.call('HINCRBY', KEYS[1], 'version', 1)\n"
+    "local bucket_ttl = at and redis.call('PTTL', bucket)\n"
+    "local old = redis.call('HGET', bucket, field(id))\n"
+    "redis.call('HSET', bucket, field(id), ARGV[1])\n"
+    "checksum(ARGV[1], old)\n"
+    "if at then\n"
+    "  keep(KEYS[1], ttl, at)\n"
+    "  keep(bucket, bucket_ttl, at)\n"
+    "  expire_field(bucket, field(id), at)\n"
+    "  keep(KEYS[2], index_ttl, at)\n"
+    "  expire_field(KEYS[2], ARGV[2], at)\n"
+    "end\n"
+    AUTO_INC_RAISE("ARGV[3]")
+    "if at then keep_keys(at) end\n"
+    "return id\n",
+
+    /*
+      REDIS_SCRIPT_COUNT
+      KEYS[1] list; ARGV[1] 0-based start index, ARGV[2] rows to look
+      at, ARGV[3] 'expiry' if rows of the table expire, which are then
+      not counted, ARGV[4] 'checksum' to add up the hashes of the rows
+      (see ROW_CHECKSUM) instead of counting them, modulo 2^32, ARGV[5]
+      'reclaim' to reclaim the expired rows met, as REDIS_SCRIPT_FETCH,
+      ARGV[6..] a pushed condition (see ROW_FILTER), which leaves out the
+      rows failing it.
+      Returns {live rows, next start index}, or {live rows} at the end of
+      the list. Only the count leaves Redis. With a condition it returns
+      {live rows, next start index or '' at the end, pos1, row1, ...},
+      followed by the rows it can't tell about, which aren't counted.
+    */
+    ROW_EXPIRY
+    ROW_CHECKSUM
+    FREE_SLOTS
+    RECLAIM
+    ROW_FILTER
+    "filter(6)\n"
+    "local start = tonumber(ARGV[1])\n"
+    "local n = tonumber(ARGV[2])\n"
+    "local sum = ARGV[4] == 'checksum'\n"
+    "local rows = redis.call('LRANGE', KEYS[1], start, start + n - 1)\n"
+    "local res = {0, ''}\n"
+    "local count = 0\n"
+    "for i, row in ipairs(rows) do\n"
+    "  if row ~= '" REDIS_TOMBSTONE "' and not (ARGV[3] == 'expiry' and expired(row)) then\n"
+    "    local m = match(row)\n"
+    "    if m then\n"
+    "      count = count + (sum and row_hash(row) or 1)\n"
+    "    elseif m == nil then\n"
+    "      res[#res + 1] = start + i\n"
+    "      res[#res + 1] = row\n"
+    "    end\n"
+    "  elseif ARGV[5] == 'reclaim' and row ~= '" REDIS_TOMBSTONE "' then\n"
+    "    reclaim(start + i, row)\n"
+    "  end\n"
+    "end\n"
+    "count = count % 4294967296\n"
+    "local after = #rows < n and '' or start + n\n"
+    "if #terms > 0 then\n"
+    "  res[1], res[2] = count, after\n"
+    "  return res\n"
+    "end\n"
+    "if after == '' then return {count} end\n"
+    "return {count, after}\n",
+
+    /*
+      REDIS_SCRIPT_BUCKET_COUNT
+      As REDIS_SCRIPT_COUNT; ARGV[1] is the first bucket and KEYS[2..]
+      the buckets of the chunk, which replace ARGV[2]. Without expiry and
+      condition the rows of a bucket are counted by HLEN.
+    */
+    ROW_EXPIRY
+    ROW_CHECKSUM
+    ROW_FILTER
+    "filter(6)\n"
+    "local first = tonumber(ARGV[1])\n"
+    "local last = tonumber(redis.call('HGET', KEYS[1], 'id') or 0)\n"
+    "local n = #KEYS - 1\n"
+    "local sum = ARGV[4] == 'checksum'\n"
+    "local res = {0, ''}\n"
+    "local count = 0\n"
+    "for i = 2, #KEYS do\n"
+    "  if #terms > 0 then\n"
+    "    local rows = redis.call('HGETALL', KEYS[i])\n"
+    "    for j = 1, #rows, 2 do\n"
+    "      local row = rows[j + 1]\n"
+    "      local m = not expired(row) and match(row)\n"
+    "      if m then\n"
+    "        count = count + 1\n"
+    "      elseif m == nil then\n"
+    "        res[#res + 1] = (first + i - 2) * " BUCKET_ROWS " + tonumber(rows[j])\n"
+    "        res[#res + 1] = row\n"
+    "      end\n"
+    "    end\n"
+    "  elseif ARGV[3] == 'expiry' or sum then\n"
+    "    for _, row in ipairs(redis.call('HVALS', KEYS[i])) do\n"
+    "      if not expired(row) then count = count + (sum and row_hash(row) or 1) end\n"
+    "    end\n"
+    "  else\n"
+    "    count = count + redis.call('HLEN', KEYS[i])\n"
+    "  end\n"
+    "end\n"
+    "count = count % 4294967296\n"
+    "local after = (first + n) * " BUCKET_ROWS " > last and '' or first + n\n"
+    "if #terms > 0 then\n"
+    "  res[1], res[2] = count, after\n"
+    "  return res\n"
+    "end\n"
+    "if after == '' then return {count} end\n"
+    "return {count, after}\n",
+
+    /*
+      REDIS_SCRIPT_STREAM_COUNT
+      As REDIS_SCRIPT_COUNT, ARGV[1] is the first entry ID ('-' for the
+      start). Without expiry and condition the stream is counted by XLEN
+      at once.
+    */
+    ROW_EXPIRY
+    ROW_CHECKSUM
+    ROW_FILTER
+    "filter(6)\n"
+    "local sum = ARGV[4] == 'checksum'\n"
+    "if #terms == 0 and ARGV[3] ~= 'expiry' and not sum then\n"
+    "  return {redis.call('XLEN', KEYS[1])}\n"
+    "end\n"
+    "local rows = redis.call('XRANGE', KEYS[1], ARGV[1], '+', 'COUNT', ARGV[2])\n"
+    "local res = {0, ''}\n"
+    "local count = 0\n"
+    "for i, entry in ipairs(rows) do\n"
+    "  local row = entry[2][2]\n"
+    "  local m = not expired(row) and match(row)\n"
+    "  if m then\n"
+    "    count = count + (sum and row_hash(row) or 1)\n"
+    "  elseif m == nil then\n"
+    "    res[#res + 1] = entry[1]\n"
+    "    res[#res + 1] = row\n"
+    "  end\n"
+    "end\n"
+    "count = count % 4294967296\n"
+    "local after = ''\n"
+    "if #rows == tonumber(ARGV[2]) then\n"
+    "  local ms, seq = string.match(rows[#rows][1], '(%d+)-(%d+)')\n"
+    "  after = ms .. '-' .. string.format('%d', tonumber(seq) + 1)\n"
+    "end\n"
+    "if #terms > 0 then\n"
+    "  res[1], res[2] = count, after\n"
+    "  return res\n"
+    "end\n"
+    "if after == '' then return {count} end\n"
+    "return {count, after}\n",
+
+    /*
+      REDIS_SCRIPT_VERIFY
+      KEYS: the KEYS of each buffered write, one after the other.
+      ARGV: 8 arguments per buffered write: 'insert', 'update', 'delete'
+      or 'replace'; the layout, 'list', 'bucket' or 'stream'; the number k
+      of its first key in KEYS, so that KEYS[k + i - 1] is KEYS[i] of the
+      write script; the position (row id, entry ID) of the row, which for
+      an insert or replace is only known in a bucket table; the row it
+      must still be unless a write before it wrote the row, or the row an
+      insert or replace writes; the index key the row had and the one it
+      gets; in a bucket table the row id which held the key it gets when
+      the statement looked (ARGV[5] of
+      REDIS_SCRIPT_BUCKET_INSERT). '' where they don't apply.
+      Checks the writes in order the way their scripts do, each one
+      seeing the effect of those before it, and writes nothing.
+      Returns {} if every write would succeed, else {n, result}: the
+      number of the first write which would fail and what its script
+      would return, -2 for an insert refused by REDIS_SCRIPT_STREAM_INSERT
+      and 0 for a write to a bucket table whose script would ask for
+      the bucket of another row.
+    */
+    ROW_EXPIRY
+    STREAM_LAST
+    "local rows, owners, last = {}, {}, {}\n"
+    "local function row_at(layout, t, pos, bucket)\n"
+    "  rows[t] = rows[t] or {}\n"
+    "  if rows[t][pos] ~= nil then return rows[t][pos] end\n"
+    "  local row\n"
+    "  if layout == 'list' then\n"
+    "    row = redis.call('LINDEX', t, tonumber(pos) - 1)\n"
+    "    if row == '" REDIS_TOMBSTONE "' then row = false end\n"
+    "  elseif layout == 'bucket' then\n"
+    "    row = redis.call('HGET', bucket, string.format('%d', tonumber(pos) % " BUCKET_ROWS "))\n"
+    "  else\n"
+    "    local entry = redis.call('XRANGE', t, pos, pos)[1]\n"
+    "    row = entry and entry[2][2]\n"
+    "  end\n"
+    "  rows[t][pos] = row or false\n"
+    "  return rows[t][pos]\n"
+    "end\n"
+    /* the position of the row holding key, true if it was written before at a position not known yet */
+    "local function owner(index, key)\n"
+    "  owners[index] = owners[index] or {}\n"
+    "  if owners[index][key] == nil then\n"
+    "    owners[index][key] = redis.call('HGET', index, key) or false\n"
+    "  end\n"
+    "  return owners[index][key]\n"
+    "end\n"
+    /*
+      give key to the row written at pos unless a live row holds it: false
+      if one does, nil if the write script of a bucket table would ask for
+      the bucket of the row (see REDIS_SCRIPT_BUCKET_INSERT)
+    */
+    "local function take(layout, t, index, key, pos, k, held_then, expires)\n"
+    "  local held = owner(index, key)\n"
+    "  if held == true then return false end\n"
+    "  if held then\n"
+    "    rows[t] = rows[t] or {}\n"
+    "    local row = rows[t][held]\n"
+    "    if row == nil and layout == 'bucket' then\n"
+    "      if not expires then return false end\n"
+    "      if held ~= held_then then return nil end\n"
+    "      row = row_at(layout, t, held, KEYS[k + 8])\n"
+    "    elseif row == nil then\n"
+    "      row = row_at(layout, t, held)\n"
+    "    end\n"
+    "    if row == true or (row and not expired(row)) then return false end\n"
+    "    rows[t][held] = false\n"
+    "  end\n"
+    "  owners[index][key] = pos\n"
+    "  return true\n"
+    "end\n"
+    "for i = 1, #ARGV, 8 do\n"
+    "  local n = (i + 7) / 8\n"
+    "  local op, layout, k, pos, row, old, new, held_then = unpack(ARGV, i, i + 7)\n"
+    "  k = tonumber(k)\n"
+    "  local t, index = KEYS[k], KEYS[k + 1]\n"
+    "  local expires = expiry(row) ~= nil\n"
+    "  if op == 'update' or op == 'delete' then\n"
+    /* a row written before is the one the transaction read it as */
+    "    local was = row_at(layout, t, pos, KEYS[k + 7])\n"
+    "    if was ~= true and was ~= row then return {n, 0} end\n"
+    "    rows[t][pos] = op == 'update'\n"
+    "    if index ~= '' and old ~= new then\n"
+    "      if op == 'update' and new ~= '' then\n"
+    "        local ok = take(layout, t, index, new, pos, k, held_then, expires)\n"
+    "        if ok == nil then return {n, 0} end\n"
+    "        if not ok then return {n, -1} end\n"
+    "      end\n"
+    "      owner(index, old)\n"
+    "      owners[index][old] = false\n"
+    "    end\n"
+    "  elseif op == 'insert' then\n"
+    "    if index ~= '' and new ~= '' then\n"
+    "      local ok = take(layout, t, index, new, pos ~= '' and pos or true, k, held_then, expires)\n"
+    "      if ok == nil then return {n, 0} end\n"
+    "      if not ok then return {n, -1} end\n"
+    "    end\n"
+    "    if pos ~= '' then\n"
+    "      rows[t] = rows[t] or {}\n"
+    "      rows[t][pos] = true\n"
+    "    end\n"
+    "    if layout == 'stream' and new ~= '' then\n"
+    "      local key = last[t] or stream_last(t, KEYS[k + 6])\n"
+    "      if #new < #key or (#new == #key and new < key) then return {n, -2} end\n"
+    "      last[t] = new\n"
+    "    end\n"
+    "  else\n"
+    "    local held = owner(index, new)\n"
+    "    if not held then\n"
+    "      held = pos ~= '' and pos or true\n"
+    "    elseif layout == 'bucket' and held ~= held_then then\n"
+    "      return {n, 0}\n"
+    "    end\n"
+    "    if held ~= true then\n"
+    "      rows[t] = rows[t] or {}\n"
+    "      rows[t][held] = true\n"
+    "    end\n"
+    "    owners[index][new] = held\n"
+    "  end\n"
+    "end\n"
+    "return {}\n",
+};
+
+static std::string redis_script_shas[REDIS_SCRIPT_MAX];
+
+void redis_scripts_init() {
+    static const char hex[] = "0123456789abcdef";
+
+    for (int i = 0; i < REDIS_SCRIPT_MAX; i++) {
+        uint8 digest[SHA1_HASH_SIZE];
+        compute_sha1_hash(digest, redis_script_sources[i],
+                          strlen(redis_script_sources[i]));
+
+        std::string &sha = redis_script_shas[i];
+        sha.clear();
+        for (int j = 0; j < SHA1_HASH_SIZE; j++) {
+            sha += hex[digest[j] >> 4];
+            sha += hex[digest[j] & 0x0f];
+        }
+    }
+}
+
+const std::string &redis_script_sha(redis_script_id id) {
+    return redis_script_shas[id];
+}
+
+/**
+  @brief
+  Fill argv/argvlen arrays which hiredis takes from an argument vector.
+*/
+static void redis_fill_argv(const Redis_args &args,
+                            std::vector<const char *> *argv,
+                            std::vector<size_t> *argvlen) {
+    argv->reserve(args.size());
+    argvlen->reserve(args.size());
+    for (const std::string &arg : args) {
+        argv->push_back(arg.data());
+        argvlen->push_back(arg.length());
+    }
+}
+
+redisReply *redis_command_args(redisContext *c, const Redis_args &args) {
+    std::vector<const char *> argv;
+    std::vector<size_t> argvlen;
+
+    redis_fill_argv(args, &argv, &argvlen);
+    return (redisReply *)redisCommandArgv(c, (int)args.size(), argv.data(),
+                                          argvlen.data());
+}
+
+int redis_append_args(redisContext *c, const Redis_args &args) {
+    std::vector<const char *> argv;
+    std::vector<size_t> argvlen;
+
+    redis_fill_argv(args, &argv, &argvlen);
+    return redisAppendCommandArgv(c, (int)args.size(), argv.data(),
+                                  argvlen.data());
+}
+
+int redis_append_script_load(redisContext *c, redis_script_id id) {
+    return redisAppendCommand(c, "SCRIPT LOAD %s", redis_script_sources[id]);
+}
+
+bool redis_load_scripts(redisContext *c) {
+    DBUG_ENTER("redis_load_scripts");
+
+    for (int i = 0; i < REDIS_SCRIPT_MAX; i++) {
+        if (redis_append_script_load(c, (redis_script_id)i) != REDIS_OK)
+            DBUG_RETURN(false);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < REDIS_SCRIPT_MAX; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(c, (void **)&reply) != REDIS_OK) DBUG_RETURN(false);
+        if (reply->type != REDIS_REPLY_STRING ||
+            redis_script_shas[i].compare(0, std::string::npos, reply->str,
+                                         reply->len) != 0)
+            ok = false;
+        freeReplyObject(reply);
+    }
+    DBUG_RETURN(ok);
+}
+
+Redis_args redis_evalsha_args(redis_script_id id, const Redis_args &keys,
+                              const Redis_args &argv) {
+    Redis_args args;
+
+    args.reserve(3 + keys.size() + argv.size());
+    args.push_back("EVALSHA");
+    args.push_back(redis_script_shas[id]);
+    args.push_back(std::to_string(keys.size()));
+    args.insert(args.end(), keys.begin(), keys.end());
+    args.insert(args.end(), argv.begin(), argv.end());
+    return args;
+}
+
+bool redis_is_noscript(const redisReply *reply) {
+    return reply->type == REDIS_REPLY_ERROR && reply->len >= 8 &&
+           strncmp(reply->str, "NOSCRIPT", 8) == 0;
+}
+
+/**
+  @brief
+  Run a command, building the reply in arena unless it is NULL.
+*/
+static redisReply *arena_command_args(redisContext *c, const Redis_args &args,
+                                      Redis_reply_arena *arena) {
+    if (arena == NULL) {
+        return redis_command_args(c, args);
+    }
+    if (redis_append_args(c, args) != REDIS_OK) {
+        return NULL;
+    }
+
+    redisReader *reader = c->reader;
+    redisReplyObjectFunctions *fn = reader->fn;
+    void *privdata = reader->privdata;
+    reader->fn = &redis_arena_functions;
+    reader->privdata = arena;
+    void *reply = NULL;
+    if (redisGetReply(c, &reply) != REDIS_OK) {
+        reply = NULL;
+    }
+    reader->fn = fn;
+    reader->privdata = privdata;
+    return static_cast<redisReply *>(reply);
+}
+
+static void free_reply(redisReply *reply, Redis_reply_arena *arena) {
+    if (arena == NULL) {
+        freeReplyObject(reply);
+    }
+}
+
+/**
+  @brief
+  Run a command, building the reply in arena unless it is NULL. A command
+  whose deadline passed is counted and its connection reconnected; a lost
+  connection is reconnected and the command replayed if it is read_only.
+*/
+static redisReply *call(redisContext *c, const Redis_args &args, Redis_reply_arena *arena,
+                        bool read_only) {
+    DBUG_ENTER("call");
+    redisReply *reply = arena_command_args(c, args, arena);
+    if (!reply && redis_timed_out(c)) {
+        // the deadline passed: don't wait for the command a second time
+        redis_io_status.deadline_expirations++;
+        redis_reconnect(c);
+        DBUG_RETURN(NULL);
+    }
+    if (!reply && (c->err == REDIS_ERR_IO || c->err == REDIS_ERR_EOF)) {
+        /*
+          The connection was lost. Reconnect so that the handler keeps
+          working, but only replay commands which don't write: a write may
+          have been applied before the connection dropped.
+        */
+        if (redis_reconnect(c) != REDIS_OK || !read_only) DBUG_RETURN(NULL);
+        reply = arena_command_args(c, args, arena);
+    }
+    DBUG_RETURN(reply);
+}
+
+redisReply *redis_call(redisContext *c, const Redis_args &args, bool read_only) {
+    return call(c, args, NULL, read_only);
+}
+
+redisReply *redis_call_arena(redisContext *c, Redis_reply_arena *arena,
+                             const Redis_args &args) {
+    return call(c, args, arena, true);
+}
+
+/**
+  @brief
+  redis_eval() and redis_eval_arena(): the reply is built in arena unless
+  it is NULL.
+*/
+static redisReply *eval(redisContext *c, redis_script_id id, const Redis_args &keys,
+                        const Redis_args &argv, Redis_reply_arena *arena) {
+    DBUG_ENTER("eval");
+    Redis_args args = redis_evalsha_args(id, keys, argv);
+    bool read_only = (id == REDIS_SCRIPT_FETCH || id == REDIS_SCRIPT_LOOKUP ||
+                      id == REDIS_SCRIPT_BUCKET_FETCH || id == REDIS_SCRIPT_BUCKET_LOOKUP ||
+                      id == REDIS_SCRIPT_STREAM_FETCH);
+
+    redisReply *reply = call(c, args, arena, read_only);
+    if (reply && redis_is_noscript(reply)) {
+        // The script cache was flushed (e.g. Redis restarted): reload, retry.
+        free_reply(reply, arena);
+        reply = (redisReply *)redisCommand(c, "SCRIPT LOAD %s",
+                                           redis_script_sources[id]);
+        if (!reply) DBUG_RETURN(NULL);
+        freeReplyObject(reply);
+        reply = arena_command_args(c, args, arena);
+    }
+    DBUG_RETURN(reply);
+}
+
+redisReply *redis_eval(redisContext *c, redis_script_id id,
+                       const Redis_args &keys, const Redis_args &argv) {
+    return eval(c, id, keys, argv, NULL);
+}
+
+redisReply *redis_eval_arena(redisContext *c, Redis_reply_arena *arena, redis_script_id id,
+                             const Redis_args &keys, const Redis_args &argv) {
+    return eval(c, id, keys, argv, arena);
+}
+
+redisReply *redis_eval_hedged(redisContext *c, redisContext *alt, redis_script_id id,
+                              const Redis_args &keys, const Redis_args &argv,
+                              ulonglong delay, bool *alt_won) {
+    DBUG_ENTER("redis_eval_hedged");
+    redisReply *reply = redis_race(c, alt, redis_evalsha_args(id, keys, argv),
+                                   delay, alt_won);
+    if (reply && redis_is_noscript(reply)) {
+        // retry on the endpoint which answered, redis_eval() reloads the script
+        freeReplyObject(reply);
+        reply = redis_eval(*alt_won ? alt : c, id, keys, argv);
+    }
+    DBUG_RETURN(reply);
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+/** @file redis_scripts.h
+
+    @brief
+  Server-side Lua scripts used by the redis storage engine.
+
+    @details
+  Row operations which need several dependent commands (e.g. a bounds check
+  before LINDEX, or a compare before LSET) are sent as one EVALSHA so that
+  they take a single round trip and run atomically inside Redis.
+  The scripts are loaded with SCRIPT LOAD once per connection and are
+  reloaded transparently when Redis answers NOSCRIPT (e.g. after a restart).
+
+   @see
+  /storage/redis/ha_redis.cc
+*/
+
+#ifndef REDIS_SCRIPTS_INCLUDED
+#define REDIS_SCRIPTS_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "my_inttypes.h"
+
+#include "hiredis.h" /* for redis */
+
+class Redis_reply_arena;
+
+/** Arguments of one Redis command, binary safe. */
+typedef std::vector<std::string> Redis_args;
+
+/** Tombstone stored in place of a deleted row until it is compacted */
+#define REDIS_TOMBSTONE "."
+
+/** Rows per bucket hash of a table in the bucket layout */
+#define REDIS_BUCKET_ROWS 128
+
+/**
+  Identifiers of the scripts in the registry.
+  The order must match redis_script_sources[] in redis_scripts.cc.
+
+  The row scripts take the list as KEYS[1], the hash of the unique index
+  as KEYS[2] ('' if the table has none), the hash of the out-of-line
+  values as KEYS[3], the auto increment counter as KEYS[4], the live
+  checksum as KEYS[5] ('' if the table keeps none), the list of the free
+  positions of a list table as KEYS[6] and the last entry ID of a stream
+  table as KEYS[7] ('' in the other layouts); the write scripts keep them
+  in sync with the list. A script touches no key it isn't passed. The
+  scan scripts (FETCH and COUNT of every layout) take a condition pushed
+  down by the handler as their last arguments and leave out the rows
+  failing it.
+
+  The REDIS_SCRIPT_BUCKET_* scripts do the same for tables in the bucket
+  layout, with the same arguments. There KEYS[1] is the table's hash
+  holding the last row id ("id") and a write counter ("version") which
+  WATCH can see. Row id N is field N % REDIS_BUCKET_ROWS of the hash
+  <table>:b:<N / REDIS_BUCKET_ROWS>. The handler reserves the row ids
+  and names the buckets: the write scripts and LOOKUP take the bucket of
+  the row as KEYS[8] and the bucket of the row holding the index key as
+  KEYS[9] ('' if none is known), FETCH and COUNT take the buckets of
+  their chunk from KEYS[2] on. Write scripts return a value > 0
+  on success, 0 when a compare-and-set failed or the row id is taken,
+  and the negated position of the conflicting row on a duplicate key.
+  A script that finds the key held by a row whose bucket it wasn't
+  passed returns {row id}; the handler calls it again with that bucket.
+
+  The REDIS_SCRIPT_STREAM_* scripts serve tables in the stream layout,
+  where KEYS[1] is a stream holding each row as the field "r" of an
+  entry. The position of a row is its entry ID. REDIS_SCRIPT_STREAM_INSERT
+  returns the number of rows it appended.
+*/
+enum redis_script_id {
+    REDIS_SCRIPT_FETCH,    ///< fetch up to N live rows from a position
+    REDIS_SCRIPT_INSERT,   ///< append a row and return its position
+    REDIS_SCRIPT_UPDATE,   ///< compare-and-set a row at a position
+    REDIS_SCRIPT_DELETE,   ///< compare-and-tombstone a row at a position
+    REDIS_SCRIPT_LOOKUP,   ///< fetch the row of an index key
+    REDIS_SCRIPT_COMPACT,  ///< remove tombstones, renumber the index
+    REDIS_SCRIPT_RENAME,   ///< rename the keys of a table
+    REDIS_SCRIPT_BUCKET_FETCH,   ///< fetch the rows of buckets from a bucket
+    REDIS_SCRIPT_BUCKET_INSERT,  ///< store a row under a new row id
+    REDIS_SCRIPT_BUCKET_UPDATE,  ///< compare-and-set a row of a bucket
+    REDIS_SCRIPT_BUCKET_DELETE,  ///< compare-and-delete a row of a bucket
+    REDIS_SCRIPT_BUCKET_LOOKUP,  ///< fetch the row of an index key
+    REDIS_SCRIPT_AUTO_INC,       ///< reserve a range of auto increment values
+    REDIS_SCRIPT_STREAM_FETCH,   ///< fetch up to N entries of an ID range
+    REDIS_SCRIPT_STREAM_INSERT,  ///< append rows under the IDs of their keys
+    REDIS_SCRIPT_STREAM_DELETE,  ///< compare-and-delete an entry
+    REDIS_SCRIPT_REPLACE,        ///< store a row under its key, overwriting the row there
+    REDIS_SCRIPT_BUCKET_REPLACE, ///< the same in a bucket
+    REDIS_SCRIPT_COUNT,          ///< count or checksum the live rows of a chunk of the list
+    REDIS_SCRIPT_BUCKET_COUNT,   ///< count or checksum the live rows of a chunk of buckets
+    REDIS_SCRIPT_STREAM_COUNT,   ///< count or checksum the live entries of a stream
+    REDIS_SCRIPT_VERIFY,         ///< check the buffered writes of a transaction
+    REDIS_SCRIPT_MAX
+};
+
+/** Compute the SHA1 digests of all scripts. Called once at plugin init. */
+void redis_scripts_init();
+
+/** SHA1 digest (hex) of a script, as used by EVALSHA. */
+const std::string &redis_script_sha(redis_script_id id);
+
+/** Send SCRIPT LOAD for every script in one pipeline. */
+bool redis_load_scripts(redisContext *c);
+
+/** Queue SCRIPT LOAD of one script without reading the reply. */
+int redis_append_script_load(redisContext *c, redis_script_id id);
+
+/** Run a command given as an argument vector. */
+redisReply *redis_command_args(redisContext *c, const Redis_args &args);
+
+/**
+  Run a command like redis_eval() runs a script: if its deadline passes,
+  it is counted and the connection reconnected; if the connection is lost,
+  it is reconnected and a read_only command sent again.
+
+  @return reply which the caller frees, or NULL when the connection failed.
+*/
+redisReply *redis_call(redisContext *c, const Redis_args &args, bool read_only);
+
+/** redis_call() of a read-only command building the reply in an arena. */
+redisReply *redis_call_arena(redisContext *c, Redis_reply_arena *arena,
+                             const Redis_args &args);
+
+/** Queue a command into the output buffer without reading the reply. */
+int redis_append_args(redisContext *c, const Redis_args &args);
+
+/** Build the EVALSHA arguments calling a script. */
+Redis_args redis_evalsha_args(redis_script_id id, const Redis_args &keys,
+                              const Redis_args &argv);
+
+/** Whether a reply is the NOSCRIPT error of an EVALSHA. */
+bool redis_is_noscript(const redisReply *reply);
+
+/**
+  Call a script by EVALSHA. A NOSCRIPT error reloads the script and retries,
+  so callers never see it.
+
+  @return reply which the caller frees, or NULL when the connection failed.
+*/
+redisReply *redis_eval(redisContext *c, redis_script_id id,
+                       const Redis_args &keys, const Redis_args &argv);
+
+/**
+  redis_eval() building the reply in an arena, for replies read at a high
+  rate. The reply stays valid until the arena is reset and must not be
+  freed with freeReplyObject().
+*/
+redisReply *redis_eval_arena(redisContext *c, Redis_reply_arena *arena, redis_script_id id,
+                             const Redis_args &keys, const Redis_args &argv);
+
+/**
+  Call a read-only script on c and, if it isn't answered within delay
+  microseconds, on alt too (see redis_race()).
+
+  @param[out] alt_won  set if the reply comes from alt
+*/
+redisReply *redis_eval_hedged(redisContext *c, redisContext *alt, redis_script_id id,
+                              const Redis_args &keys, const Redis_args &argv,
+                              ulonglong delay, bool *alt_won);
+
+#endif /* REDIS_SCRIPTS_INCLUDED */
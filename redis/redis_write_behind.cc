@@ -0,0 +1,345 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+
+/** @file redis_write_behind.cc
+
+    @brief
+  Write-behind queue and flusher of the redis storage engine.
+*/
+
+#include "redis_write_behind.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "my_dbug.h"
+#include "my_sys.h"
+
+#include "hiredis.h" /* for redis */
+#include "redis_io.h"
+
+ulong redis_write_behind_interval = 100;
+
+Redis_write_behind_status redis_write_behind_status;
+
+/** A command waiting in the queue */
+struct Redis_queued_write {
+    Redis_args command;
+    uint rows;
+};
+
+/**
+  Bounded queue filled by many sessions and emptied by the flusher alone.
+  Each slot has a sequence number telling whose turn it is: the producer
+  of position pos may fill the slot when it holds pos, the consumer may
+  empty it when it holds pos + 1, after which it holds pos + size for the
+  next round.
+*/
+class Redis_write_ring {
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Redis_queued_write *write;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;  ///< next position to fill
+    alignas(64) std::atomic<size_t> tail;  ///< next position to empty
+
+public:
+    Redis_write_ring() : mask(0), head(0), tail(0) {}
+
+    /** Make room for at least size commands (rounded up to a power of two). */
+    void init(size_t size) {
+        size_t n = 1;
+        while (n < size) {
+            n <<= 1;
+        }
+        slots.reset(new Slot[n]);
+        for (size_t i = 0; i < n; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+            slots[i].write = NULL;
+        }
+        mask = n - 1;
+    }
+
+    /** @return false if the queue is full, else the position taken in *taken. */
+    bool push(Redis_queued_write *w, size_t *taken) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = slots[pos & mask];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.write = w;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    *taken = pos;
+                    return true;
+                }
+            } else if (diff < 0) {
+                // the slot of the previous round wasn't emptied yet
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /** @return the oldest command, NULL if there is none. */
+    Redis_queued_write *pop() {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot &slot = slots[pos & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return NULL;
+        }
+        Redis_queued_write *w = slot.write;
+        slot.sequence.store(pos + mask + 1, std::memory_order_release);
+        tail.store(pos + 1, std::memory_order_release);
+        return w;
+    }
+
+    /** Positions taken so far, including those still being filled */
+    size_t filled() const { return head.load(std::memory_order_acquire); }
+
+    /** Commands waiting, approximately */
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return h > t ? h - t : 0;
+    }
+};
+
+static Redis_write_ring ring;
+static std::string flusher_host;
+static int flusher_port;
+static std::thread flusher;
+static bool running = false;
+
+/* Wakes the flusher, protected by wake_lock */
+static std::mutex wake_lock;
+static std::condition_variable wake;
+static bool urgent = false;
+static bool stopping = false;
+
+/* Positions of the queue whose commands were answered, signalled by done */
+static std::mutex done_lock;
+static std::condition_variable done;
+static std::atomic<size_t> answered(0);
+
+/** Connection of the flusher, only used by its thread */
+static redisContext *flusher_conn = NULL;
+
+static void redis_write_behind_wake() {
+    std::lock_guard<std::mutex> guard(wake_lock);
+    urgent = true;
+    wake.notify_one();
+}
+
+/**
+  Count a command as written or failed by its reply: the insert scripts
+  return a positive number, 0 or a negative one for a row they refused.
+*/
+static void redis_write_behind_count(const Redis_queued_write *w, const redisReply *reply) {
+    if (reply && reply->type == REDIS_REPLY_INTEGER && reply->integer > 0) {
+        redis_write_behind_status.flushed += w->rows;
+    } else {
+        redis_write_behind_status.failed += w->rows;
+    }
+}
+
+/**
+  Send a batch in one pipeline and read the replies. Commands which found
+  their script missing (Redis was restarted meanwhile) are sent again once
+  the scripts are loaded. When the connection fails, the commands not
+  answered yet are lost and it is opened again for the next batch.
+*/
+static void redis_write_behind_send(const std::vector<Redis_queued_write *> &batch) {
+    DBUG_ENTER("redis_write_behind_send");
+    if (flusher_conn == NULL) {
+        flusher_conn = redis_connect_to(flusher_host.c_str(), flusher_port);
+        if (flusher_conn && (flusher_conn->err || !redis_load_scripts(flusher_conn))) {
+            redisFree(flusher_conn);
+            flusher_conn = NULL;
+        }
+    }
+
+    size_t sent = 0;
+    if (flusher_conn) {
+        redis_apply_timeout(flusher_conn);
+        while (sent < batch.size() &&
+               redis_append_args(flusher_conn, batch[sent]->command) == REDIS_OK) {
+            sent++;
+        }
+    }
+
+    std::vector<const Redis_queued_write *> retry;
+    for (size_t i = 0; i < batch.size(); i++) {
+        redisReply *reply = NULL;
+        if (i >= sent || flusher_conn == NULL ||
+            redisGetReply(flusher_conn, (void **)&reply) != REDIS_OK) {
+            if (i < sent && flusher_conn) {
+                redisFree(flusher_conn);
+                flusher_conn = NULL;
+            }
+            redis_write_behind_count(batch[i], NULL);
+            continue;
+        }
+        if (redis_is_noscript(reply)) {
+            retry.push_back(batch[i]);
+        } else {
+            redis_write_behind_count(batch[i], reply);
+        }
+        freeReplyObject(reply);
+    }
+    if (!retry.empty() && flusher_conn && !redis_load_scripts(flusher_conn)) {
+        redisFree(flusher_conn);
+        flusher_conn = NULL;
+    }
+    for (const Redis_queued_write *w : retry) {
+        redisReply *reply = flusher_conn ? redis_command_args(flusher_conn, w->command) : NULL;
+        redis_write_behind_count(w, reply);
+        if (reply) {
+            freeReplyObject(reply);
+        }
+    }
+
+    for (Redis_queued_write *w : batch) {
+        delete w;
+    }
+    {
+        std::lock_guard<std::mutex> guard(done_lock);
+        answered += batch.size();
+    }
+    done.notify_all();
+    DBUG_VOID_RETURN;
+}
+
+/**
+  Body of the flusher: wait for the interval or a wake-up, then drain the
+  queue in batches. After stop, the queue is drained a last time.
+*/
+static void redis_write_behind_run() {
+    my_thread_init();
+    std::vector<Redis_queued_write *> batch;
+    batch.reserve(REDIS_WRITE_BEHIND_BATCH);
+    for (;;) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> guard(wake_lock);
+            wake.wait_for(guard, std::chrono::milliseconds(redis_write_behind_interval),
+                          [] { return urgent || stopping; });
+            urgent = false;
+            stop = stopping;
+        }
+        Redis_queued_write *w;
+        while ((w = ring.pop()) != NULL) {
+            batch.push_back(w);
+            if (batch.size() == REDIS_WRITE_BEHIND_BATCH) {
+                redis_write_behind_send(batch);
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            redis_write_behind_send(batch);
+            batch.clear();
+        }
+        if (stop) {
+            break;
+        }
+    }
+    if (flusher_conn) {
+        redisFree(flusher_conn);
+        flusher_conn = NULL;
+    }
+    my_thread_end();
+}
+
+bool redis_write_behind_start(const char *host, int port, size_t queue_size) {
+    ring.init(queue_size);
+    flusher_host = host ? host : "";
+    flusher_port = port;
+    stopping = false;
+    try {
+        flusher = std::thread(redis_write_behind_run);
+    } catch (const std::system_error &) {
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void redis_write_behind_stop() {
+    if (!running) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+        wake.notify_one();
+    }
+    flusher.join();
+    running = false;
+}
+
+size_t redis_write_behind_add(Redis_args &&command, uint rows) {
+    Redis_queued_write *w = new Redis_queued_write{std::move(command), rows};
+    redis_write_behind_status.queued += rows;
+    size_t pos;
+    if (!ring.push(w, &pos)) {
+        // backpressure: wait for the flusher to make room
+        redis_write_behind_status.stalls++;
+        redis_write_behind_wake();
+        std::unique_lock<std::mutex> guard(done_lock);
+        while (!ring.push(w, &pos)) {
+            done.wait_for(guard, std::chrono::milliseconds(1));
+        }
+    }
+    if (ring.size() == REDIS_WRITE_BEHIND_BATCH) {
+        redis_write_behind_wake();
+    }
+    // the commands are answered in the order of their positions
+    return pos + 1;
+}
+
+void redis_write_behind_flush() {
+    redis_write_behind_flush_to(ring.filled());
+}
+
+void redis_write_behind_flush_to(size_t target) {
+    if (!running || answered.load() >= target) {
+        return;
+    }
+    redis_write_behind_wake();
+    std::unique_lock<std::mutex> guard(done_lock);
+    while (answered.load() < target) {
+        done.wait_for(guard, std::chrono::milliseconds(10));
+    }
+}
@@ -0,0 +1,108 @@
+/* Copyright (c) 2004, 2019, Oracle and/or its affiliates. All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License, version 2.0,
+  as published by the Free Software Foundation.
+
+  This program is also distributed with certain software (including
+  but not limited to OpenSSL) that is licensed under separate terms,
+  as designated in a particular file or component or in included license
+  documentation.  The authors of MySQL hereby grant you an additional
+  permission to link the program and your derivative works with the
+  separately licensed software that they have included with MySQL.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License, version 2.0, for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA */
+
+
+/** @file redis_write_behind.h
+
+    @brief
+  Write-behind inserts of the redis storage engine.
+
+    @details
+  With redis_write_behind set (or redis_write_behind=on in the table
+  COMMENT), an insert is encoded and put into a bounded queue shared by
+  all sessions instead of being sent to Redis; the statement doesn't wait
+  for it. A background thread drains the queue every
+  redis_write_behind_interval milliseconds, or as soon as a batch of
+  REDIS_WRITE_BEHIND_BATCH inserts is waiting, and sends each batch in one
+  pipeline over a connection of its own.
+
+  The queue is a ring of redis_write_behind_queue_size slots which
+  sessions fill and the thread empties without a lock; a session finding
+  it full waits for the thread to make room. An insert which fails in
+  Redis (a duplicate key, a lost connection) can't be reported to its
+  statement anymore and is only counted.
+
+  What a table queued is written before the table is closed (FLUSH
+  TABLES). Everything queued is written before a table is truncated,
+  renamed or dropped, and before the plugin is unloaded.
+
+   @see
+  /storage/redis/ha_redis.cc
+*/
+
+#ifndef REDIS_WRITE_BEHIND_INCLUDED
+#define REDIS_WRITE_BEHIND_INCLUDED
+
+#include <atomic>
+
+#include "my_inttypes.h"
+
+#include "redis_scripts.h"
+
+/** Inserts which wake the flusher before its interval is over */
+#define REDIS_WRITE_BEHIND_BATCH 1024
+
+/** Milliseconds between two flushes when fewer inserts are queued */
+extern ulong redis_write_behind_interval;
+
+/** Counters shown as status variables */
+struct Redis_write_behind_status {
+    std::atomic<ulong> queued;   ///< rows put into the queue
+    std::atomic<ulong> flushed;  ///< rows written to Redis
+    std::atomic<ulong> failed;   ///< rows Redis refused or which were lost
+    std::atomic<ulong> stalls;   ///< inserts which waited for room in the queue
+};
+
+extern Redis_write_behind_status redis_write_behind_status;
+
+/**
+  Size the queue and start the flusher, which connects to host:port when
+  it first has something to write. Called once at plugin init.
+
+  @return false if the thread couldn't be started.
+*/
+bool redis_write_behind_start(const char *host, int port, size_t queue_size);
+
+/** Write what is queued and stop the flusher. Called at plugin deinit. */
+void redis_write_behind_stop();
+
+/**
+  Queue a command, waiting while the queue is full.
+
+  @param command  arguments of the command, e.g. from redis_evalsha_args()
+  @param rows     rows the command inserts, counted when it is answered
+                  (0 for a command which goes along, like XTRIM)
+
+  @return the mark of the command for redis_write_behind_flush_to().
+*/
+size_t redis_write_behind_add(Redis_args &&command, uint rows);
+
+/**
+  Wait until the command of a mark returned by redis_write_behind_add(),
+  and those queued before it, were answered.
+*/
+void redis_write_behind_flush_to(size_t mark);
+
+/** Wait until every command queued before the call was answered. */
+void redis_write_behind_flush();
+
+#endif /* REDIS_WRITE_BEHIND_INCLUDED */